@@ -0,0 +1,80 @@
+/**
+ * @file cli/catalog.cpp
+ *
+ * @brief
+ *
+ * @author Jordan Bieder
+ *
+ * @copyright Copyright (C) 2023 Jordan Bieder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "catalog.hpp"
+
+#include <filesystem>
+#include <fmt/core.h>
+#include <fmt/ostream.h>
+#include <iostream>
+
+namespace TitleFinder {
+
+namespace Cli {
+
+Catalog::Catalog(int argc, char* argv[]) : SubApp(argc, argv) {
+  _parser.setBinaryName(TITLEFINDER_NAME " catalog");
+  _parser.setOption("movies", 'm', "",
+                    "TMDB daily export of movie ids (movie_ids_*.json.gz)");
+  _parser.setOption("tvshows", 't', "",
+                    "TMDB daily export of tv series ids "
+                    "(tv_series_ids_*.json.gz)");
+}
+
+int Catalog::run() {
+  std::filesystem::path movies;
+  std::filesystem::path tvshows;
+  try {
+    _parser.parse();
+
+    if (_parser.isSetOption("help")) {
+      std::cout << _parser << std::endl;
+      return 0;
+    }
+    if (_parser.isSetOption("movies"))
+      movies = _parser.getOption<std::string>("movies");
+    if (_parser.isSetOption("tvshows"))
+      tvshows = _parser.getOption<std::string>("tvshows");
+  } catch (const std::exception& e) {
+    fmt::print(std::cerr, "Exception occured: {}\n", e.what());
+    return 1;
+  }
+
+  if (movies.empty() && tvshows.empty()) {
+    fmt::print(std::cerr, "Nothing to import, use --movies or --tvshows.\n");
+    return 1;
+  }
+
+  try {
+    const size_t count = _engine.importCatalog(movies, tvshows);
+    fmt::print("Catalog built with {} titles\n", count);
+  } catch (const std::exception& e) {
+    fmt::print(std::cerr, "Failed to build the catalog: {}\n", e.what());
+    return 1;
+  }
+  return 0;
+}
+
+} // namespace Cli
+
+} // namespace TitleFinder
@@ -0,0 +1,50 @@
+/**
+ * @file cli/catalog.hpp
+ *
+ * @brief
+ *
+ * @author Jordan Bieder
+ *
+ * @copyright Copyright (C) 2023 Jordan Bieder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "subapp.hpp"
+
+namespace TitleFinder {
+
+namespace Cli {
+
+class Catalog final : public SubApp {
+
+public:
+  /**
+   * Empty constructor
+   */
+  Catalog(int argc, char* argv[]);
+
+  /**
+   * Destructor
+   */
+  ~Catalog() final = default;
+
+  int run() final;
+};
+
+} // namespace Cli
+
+} // namespace TitleFinder
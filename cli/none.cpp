@@ -40,7 +40,7 @@ namespace Cli {
 
 None::None(int argc, char* argv[]) : Application(argc, argv) {
   _parser.setOption("version", 'v', "Print help message");
-  _parser.setBinaryName(TITLEFINDER_NAME " (search|rename|scan)");
+  _parser.setBinaryName(TITLEFINDER_NAME " (search|rename|scan|catalog)");
 }
 
 int None::run() {
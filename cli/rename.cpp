@@ -45,6 +45,13 @@ Rename::Rename(int argc, char* argv[])
                     "Output directory to rename/remux the file.");
   _parser.setOption("blacklist", 'b', "", "Blacklist file containing filters");
   _parser.setOption("cache", 'c', "Use cache files to reduce requests");
+  _parser.setOption("shared-cache", 's',
+                    "Share cached data with other running instances");
+  _parser.setOption("scorer", 'x', "levenshtein",
+                    "Method used to select the search result",
+                    {"levenshtein", "tokens"});
+  _parser.setOption("catalog", 'a',
+                    "Look tv shows up in the local catalog first");
   if (argc - 1 >= 0)
     _filename = argv[argc - 1];
 }
@@ -70,6 +77,12 @@ int Rename::prepare() {
     } else {
       _engine.useCache(_parser.getOption<bool>("cache"));
     }
+    _engine.useSharedCache(_parser.isSetOption("shared-cache"));
+    if (_parser.getOption<std::string>("scorer") == "tokens")
+      _engine.setScorer(Explorer::Engine::Scorer::TokenSet);
+    else
+      _engine.setScorer(Explorer::Engine::Scorer::Levenshtein);
+    _engine.useCatalog(_parser.isSetOption("catalog"));
 
     _outputDirectory = std::filesystem::absolute(_filename).parent_path();
     if (_parser.isSetOption("output-directory")) {
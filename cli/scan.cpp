@@ -24,12 +24,18 @@
 #include "scan.hpp"
 #include <filesystem>
 #include <fmt/core.h>
+#include <fmt/format.h>
 #include <fmt/ostream.h>
 
 namespace TitleFinder {
 
 namespace Cli {
 
+namespace {
+// Upper bound of the jobs of a stage with --adaptive when --jobs is unset
+constexpr int kAdaptiveMaxJobs = 16;
+} // namespace
+
 Scan::Scan(int argc, char* argv[]) : Rename(argc, argv) {
   _parser.setBinaryName(TITLEFINDER_NAME " scan");
 }
@@ -40,7 +46,41 @@ void Scan::setOptionalOptions() {
   _parser.setOption("jobs", 'j', "1",
                     "Number of jobs working at the same time (only in none "
                     "interactive mode).");
+  _parser.setOption("probe-jobs", "0",
+                    "Number of jobs reading files (0 means --jobs).");
+  _parser.setOption("lookup-jobs", "0",
+                    "Number of jobs querying TheMovieDB (0 means --jobs).");
+  _parser.setOption("apply-jobs", "0",
+                    "Number of jobs renaming or transmuxing files (0 means "
+                    "--jobs).");
+  _parser.setOption("adaptive",
+                    "Adjust the jobs of each stage at runtime, between "
+                    "--min-jobs and the jobs of the stage (16 without "
+                    "--jobs)");
+  _parser.setOption("min-jobs", "1",
+                    "Fewest jobs of a stage with --adaptive.");
+  _parser.setOption("list-jobs", "0",
+                    "Number of folders listed at the same time (0 means "
+                    "--jobs).");
+  _parser.setOption("async-stat",
+                    "Stat files by batches through io_uring (for network "
+                    "file systems)");
+  _parser.setOption("include", "",
+                    "Comma separated patterns of the files to scan (default "
+                    "*.mp4,*.mkv,*.avi)");
+  _parser.setOption("exclude", "",
+                    "Comma separated patterns of files and folders to skip, "
+                    "folders end with '/' (hidden folders, samples and "
+                    "extras are always skipped)");
   _parser.setOption("recursive", 'r', "Scan files recursively");
+  _parser.setOption("changed-only", 'u',
+                    "Skip files unchanged since they were last processed");
+  _parser.setOption("prune-manifest",
+                    "With --changed-only, forget the processed files that "
+                    "were deleted (checks every file ever processed)");
+  _parser.setOption("learn-tags", 'g',
+                    "Strip release tags repeated over the scanned files "
+                    "from searched titles");
 }
 
 int Scan::run() {
@@ -57,8 +97,64 @@ int Scan::run() {
     return 1;
   }
 
+  _engine.useManifest(_parser.isSetOption("changed-only"),
+                      _parser.isSetOption("prune-manifest"));
+
+  auto jobs = [this](const std::string& option, int fallback) {
+    try {
+      const int value = _parser.getOption<int>(option);
+      return value > 0 ? value : fallback;
+    } catch (const std::exception& e) {
+      return fallback;
+    }
+  };
+  const bool adaptive = _parser.isSetOption("adaptive");
+  const int all = adaptive && !_parser.isSetOption("jobs")
+                      ? kAdaptiveMaxJobs
+                      : jobs("jobs", 1);
+  const Explorer::Engine::Workers workers{
+      jobs("probe-jobs", all), jobs("lookup-jobs", all),
+      jobs("apply-jobs", all), adaptive, jobs("min-jobs", 1)};
+  _engine.setListingJobs(jobs("list-jobs", all));
+  _engine.useAsynchronousStat(_parser.isSetOption("async-stat"));
+  try {
+    auto patterns = [this](const std::string& option) {
+      std::vector<std::string> list;
+      const std::string value = _parser.getOption<std::string>(option);
+      for (size_t begin = 0; begin < value.size();) {
+        size_t end = value.find(',', begin);
+        if (end == std::string::npos)
+          end = value.size();
+        if (end > begin)
+          list.push_back(value.substr(begin, end - begin));
+        begin = end + 1;
+      }
+      return list;
+    };
+    _engine.setIncludes(patterns("include"));
+    _engine.addExcludes(patterns("exclude"));
+  } catch (const std::exception& e) {
+    fmt::print(std::cerr, "{}\n", e.what());
+    return 1;
+  }
+
+  if (!_parser.isSetOption("interactive") &&
+      !_parser.isSetOption("learn-tags")) {
+    // Nothing needs the whole list: process files while listing them
+    fmt::print("Analyzing files in {}\n", _filename);
+    _engine.autoRename(std::filesystem::path(_filename),
+                       _parser.isSetOption("recursive"), _container, workers,
+                       _outputDirectory);
+    return 0;
+  }
+
   auto list = _engine.listFiles(_filename, _parser.isSetOption("recursive"));
   fmt::print("Will analyze {} files in {}\n", list.size(), _filename);
+  if (_parser.isSetOption("learn-tags")) {
+    const auto tags = _engine.learnTags(list);
+    fmt::print("Learned {} release tags: {}\n", tags.size(),
+               fmt::join(tags, " "));
+  }
   if (_parser.isSetOption("interactive")) {
     while (!list.empty()) {
       auto& file = list.front();
@@ -81,13 +177,7 @@ int Scan::run() {
       list.pop();
     }
   } else {
-    int jobs = 1;
-    try {
-      jobs = _parser.getOption<int>("jobs");
-    } catch (const std::exception& e) {
-      jobs = 1;
-    }
-    _engine.autoRename(list, _container, jobs, _outputDirectory);
+    _engine.autoRename(list, _container, workers, _outputDirectory);
   }
   return 0;
 }
@@ -1,5 +1,6 @@
 #include <memory>
 
+#include "catalog.hpp"
 #include "none.hpp"
 #include "rename.hpp"
 #include "scan.hpp"
@@ -16,6 +17,8 @@ int main(int argc, char** argv) {
       app.reset(new Cli::Rename(argc - 1, argv + 1));
     } else if (strcmp("scan", argv[1]) == 0) {
       app.reset(new Cli::Scan(argc - 1, argv + 1));
+    } else if (strcmp("catalog", argv[1]) == 0) {
+      app.reset(new Cli::Catalog(argc - 1, argv + 1));
     } else {
       app.reset(new Cli::None(argc, argv));
     }
@@ -37,7 +37,7 @@ namespace Api {
 class Search {
 
 public:
-  template <class R> class SearchResults : public Response {
+  template <class R> class SearchResults : public Response, public BaseJson {
   public:
     int page;
     std::vector<R> results;
@@ -46,7 +46,7 @@ public:
     SearchResults()
         : Response(200), page(0), results(), total_results(0), total_pages(0) {}
     ~SearchResults() = default;
-    inline void from_json(const nlohmann::json& j) {
+    inline void from_json(nlohmann::json& j) {
       fillOption(j, page);
       fillOption(j, total_pages);
       fillOption(j, total_results);
@@ -56,6 +56,7 @@ public:
         auto& info = results[i];
         info.from_json(show);
       }
+      _json = std::move(j);
     }
   };
 
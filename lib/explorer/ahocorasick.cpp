@@ -0,0 +1,418 @@
+/**
+ * @file explorer/ahocorasick.cpp
+ *
+ * @brief Multi-pattern literal replacement
+ *
+ * @author Jordan Bieder
+ *
+ * @copyright Copyright (C) 2023 Jordan Bieder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "explorer/ahocorasick.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <limits>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "explorer/cache.hpp"
+#include "explorer/logger.hpp"
+
+namespace {
+
+constexpr uint32_t kMagic = 0x4b434841; // AHCK
+constexpr uint32_t kVersion = 1;
+constexpr uint32_t kNone = std::numeric_limits<uint32_t>::max();
+
+inline unsigned char fold(unsigned char c) {
+  return c >= 'A' && c <= 'Z' ? static_cast<unsigned char>(c + ('a' - 'A'))
+                              : c;
+}
+
+inline size_t words(size_t bytes) { return (bytes + 3) / 4; }
+
+} // namespace
+
+namespace TitleFinder {
+
+namespace Explorer {
+
+struct AhoCorasick::Header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t states;
+  uint32_t classes;
+  uint32_t patterns;
+  uint32_t outputs;
+  uint32_t strings; ///< size in bytes
+  uint32_t reserved;
+  uint8_t classOf[256];
+};
+
+struct AhoCorasick::Info {
+  uint32_t source; ///< offset in the strings
+  uint32_t sourceLength;
+  uint32_t replacement;
+  uint32_t replacementLength;
+  uint32_t caseSensitive;
+};
+
+AhoCorasick::AhoCorasick() : AhoCorasick(std::vector<Pattern>()) {}
+
+AhoCorasick::AhoCorasick(const std::vector<Pattern>& patterns)
+    : _storage(), _data(nullptr), _mapping(nullptr), _mapped(0) {
+  static_assert(sizeof(Header) % 4 == 0 && sizeof(Info) % 4 == 0,
+                "Sections must stay aligned on 32 bits");
+  // Byte classes, 0 for bytes found in no pattern
+  uint8_t classOf[256] = {0};
+  uint32_t classes = 1;
+  for (const auto& p : patterns) {
+    for (unsigned char c : p.source) {
+      const unsigned char f = fold(c);
+      if (classOf[f] == 0) {
+        if (classes > std::numeric_limits<uint8_t>::max())
+          throw std::length_error("Too many distinct bytes in patterns");
+        classOf[f] = static_cast<uint8_t>(classes++);
+      }
+    }
+  }
+  for (unsigned c = 'A'; c <= 'Z'; ++c)
+    classOf[c] = classOf[fold(static_cast<unsigned char>(c))];
+
+  // Trie of the folded patterns
+  std::vector<uint32_t> next(classes, kNone);
+  std::vector<std::vector<uint32_t>> own(1);
+  for (uint32_t id = 0; id < patterns.size(); ++id) {
+    uint32_t state = 0;
+    for (unsigned char c : patterns[id].source) {
+      uint32_t& to = next[state * classes + classOf[c]];
+      if (to == kNone) {
+        to = static_cast<uint32_t>(own.size());
+        own.emplace_back();
+        next.resize(next.size() + classes, kNone);
+      }
+      state = next[state * classes + classOf[c]];
+    }
+    if (state != 0)
+      own[state].push_back(id);
+  }
+  const auto states = static_cast<uint32_t>(own.size());
+
+  // Breadth first: resolve every transition and merge the outputs of the
+  // failure state, always processed before.
+  std::vector<uint32_t> fail(states, 0);
+  std::vector<std::vector<uint32_t>> out(states);
+  std::deque<uint32_t> queue;
+  for (uint32_t c = 0; c < classes; ++c) {
+    uint32_t& to = next[c];
+    if (to == kNone) {
+      to = 0;
+    } else {
+      queue.push_back(to);
+    }
+  }
+  while (!queue.empty()) {
+    const uint32_t s = queue.front();
+    queue.pop_front();
+    out[s] = own[s];
+    out[s].insert(out[s].end(), out[fail[s]].begin(), out[fail[s]].end());
+    for (uint32_t c = 0; c < classes; ++c) {
+      uint32_t& to = next[s * classes + c];
+      const uint32_t viaFail = next[fail[s] * classes + c];
+      if (to == kNone) {
+        to = viaFail;
+      } else {
+        fail[to] = viaFail;
+        queue.push_back(to);
+      }
+    }
+  }
+
+  // Flat layout
+  size_t outputs = 0;
+  for (const auto& o : out)
+    outputs += o.size();
+  std::string strings;
+  for (const auto& p : patterns) {
+    strings += p.source;
+    strings += p.replacement;
+  }
+  if (strings.size() > kNone || outputs > kNone)
+    throw std::length_error("Patterns are too large");
+  Header header{kMagic,
+                kVersion,
+                states,
+                classes,
+                static_cast<uint32_t>(patterns.size()),
+                static_cast<uint32_t>(outputs),
+                static_cast<uint32_t>(strings.size()),
+                0,
+                {}};
+  std::memcpy(header.classOf, classOf, sizeof(classOf));
+  _storage.assign(words(size(&header)), 0);
+  std::memcpy(_storage.data(), &header, sizeof(header));
+  _data = reinterpret_cast<const char*>(_storage.data());
+
+  std::copy(next.begin(), next.end(), const_cast<uint32_t*>(transitions()));
+  auto* start = const_cast<uint32_t*>(outputStart());
+  auto* o = const_cast<uint32_t*>(this->outputs());
+  uint32_t n = 0;
+  for (uint32_t s = 0; s < states; ++s) {
+    start[s] = n;
+    std::copy(out[s].begin(), out[s].end(), o + n);
+    n += static_cast<uint32_t>(out[s].size());
+  }
+  start[states] = n;
+  auto* info = const_cast<Info*>(infos());
+  uint32_t offset = 0;
+  for (uint32_t id = 0; id < patterns.size(); ++id) {
+    const auto& p = patterns[id];
+    info[id] = {offset, static_cast<uint32_t>(p.source.size()),
+                offset + static_cast<uint32_t>(p.source.size()),
+                static_cast<uint32_t>(p.replacement.size()),
+                p.caseSensitive ? 1u : 0u};
+    offset += static_cast<uint32_t>(p.source.size() + p.replacement.size());
+  }
+  std::memcpy(const_cast<char*>(this->strings()), strings.data(),
+              strings.size());
+}
+
+AhoCorasick::AhoCorasick(AhoCorasick&& other) noexcept
+    : _storage(std::move(other._storage)), _data(other._data),
+      _mapping(other._mapping), _mapped(other._mapped) {
+  other._data = nullptr;
+  other._mapping = nullptr;
+  other._mapped = 0;
+}
+
+AhoCorasick& AhoCorasick::operator=(AhoCorasick&& other) noexcept {
+  if (this != &other) {
+    this->release();
+    _storage = std::move(other._storage);
+    _data = other._data;
+    _mapping = other._mapping;
+    _mapped = other._mapped;
+    other._data = nullptr;
+    other._mapping = nullptr;
+    other._mapped = 0;
+  }
+  return *this;
+}
+
+AhoCorasick::~AhoCorasick() { this->release(); }
+
+void AhoCorasick::release() {
+  if (_mapping)
+    ::munmap(_mapping, _mapped);
+  _mapping = nullptr;
+  _mapped = 0;
+  _storage.clear();
+  _data = nullptr;
+}
+
+size_t AhoCorasick::size(const Header* h) {
+  return sizeof(Header) +
+         4 * (static_cast<size_t>(h->states) * h->classes + h->states + 1 +
+              h->outputs) +
+         sizeof(Info) * h->patterns + 4 * words(h->strings);
+}
+
+void AhoCorasick::save(const std::filesystem::path& file) const {
+  if (!_data)
+    throw std::logic_error("Cannot save an empty automaton");
+  atomicWrite(file, std::string(_data, size(this->header())));
+}
+
+bool AhoCorasick::map(const std::filesystem::path& file) {
+  int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (::fstat(fd, &st) != 0 ||
+      static_cast<size_t>(st.st_size) < sizeof(Header)) {
+    ::close(fd);
+    return false;
+  }
+  const size_t bytes = static_cast<size_t>(st.st_size);
+  void* p = ::mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED) {
+    Logger()->debug("Unable to map {}: {}", file.string(),
+                    std::strerror(errno));
+    return false;
+  }
+  const auto* h = static_cast<const Header*>(p);
+  if (h->magic != kMagic || h->version != kVersion || h->states == 0 ||
+      h->classes == 0 || size(h) != bytes) {
+    Logger()->warn("{} is not a valid automaton", file.string());
+    ::munmap(p, bytes);
+    return false;
+  }
+  // Unmapped again on the way out unless it is valid
+  AhoCorasick mapped;
+  mapped.release();
+  mapped._mapping = p;
+  mapped._mapped = bytes;
+  mapped._data = static_cast<const char*>(p);
+  if (!mapped.isValid()) {
+    Logger()->warn("{} is a damaged automaton", file.string());
+    return false;
+  }
+  *this = std::move(mapped);
+  return true;
+}
+
+bool AhoCorasick::isValid() const {
+  const Header* h = this->header();
+  for (unsigned c = 0; c < 256; ++c) {
+    if (h->classOf[c] >= h->classes)
+      return false;
+  }
+  const uint32_t* next = this->transitions();
+  const size_t transitions = static_cast<size_t>(h->states) * h->classes;
+  for (size_t i = 0; i < transitions; ++i) {
+    if (next[i] >= h->states)
+      return false;
+  }
+  const uint32_t* start = this->outputStart();
+  if (start[0] != 0 || start[h->states] != h->outputs)
+    return false;
+  for (uint32_t s = 0; s < h->states; ++s) {
+    if (start[s] > start[s + 1])
+      return false;
+  }
+  const uint32_t* outputs = this->outputs();
+  for (uint32_t k = 0; k < h->outputs; ++k) {
+    if (outputs[k] >= h->patterns)
+      return false;
+  }
+  const Info* info = this->infos();
+  for (uint32_t id = 0; id < h->patterns; ++id) {
+    const Info& p = info[id];
+    if (p.sourceLength == 0 ||
+        static_cast<size_t>(p.source) + p.sourceLength > h->strings ||
+        static_cast<size_t>(p.replacement) + p.replacementLength > h->strings)
+      return false;
+  }
+  return true;
+}
+
+const uint32_t* AhoCorasick::transitions() const {
+  return reinterpret_cast<const uint32_t*>(_data + sizeof(Header));
+}
+
+const uint32_t* AhoCorasick::outputStart() const {
+  const Header* h = this->header();
+  return transitions() + static_cast<size_t>(h->states) * h->classes;
+}
+
+const uint32_t* AhoCorasick::outputs() const {
+  return outputStart() + this->header()->states + 1;
+}
+
+const AhoCorasick::Info* AhoCorasick::infos() const {
+  return reinterpret_cast<const Info*>(outputs() + this->header()->outputs);
+}
+
+const char* AhoCorasick::strings() const {
+  return reinterpret_cast<const char*>(infos() + this->header()->patterns);
+}
+
+size_t AhoCorasick::states() const {
+  return _data ? this->header()->states : 0;
+}
+
+size_t AhoCorasick::patterns() const {
+  return _data ? this->header()->patterns : 0;
+}
+
+std::string AhoCorasick::replace(std::string_view input) const {
+  const Header* h = this->header();
+  if (!h || h->patterns == 0)
+    return std::string(input);
+  const uint32_t* next = this->transitions();
+  const uint32_t* start = this->outputStart();
+  const uint32_t* outputs = this->outputs();
+  const Info* info = this->infos();
+  const char* strings = this->strings();
+
+  struct Match {
+    uint32_t pattern;
+    uint32_t begin;
+  };
+  std::vector<Match> matches;
+  uint32_t state = 0;
+  for (size_t i = 0; i < input.size(); ++i) {
+    const auto c = static_cast<unsigned char>(input[i]);
+    state = next[state * h->classes + h->classOf[c]];
+    for (uint32_t k = start[state]; k < start[state + 1]; ++k) {
+      const Info& p = info[outputs[k]];
+      // Only a damaged automaton ends a pattern before its length
+      if (p.sourceLength > i + 1)
+        continue;
+      const size_t begin = i + 1 - p.sourceLength;
+      if (p.caseSensitive &&
+          std::memcmp(input.data() + begin, strings + p.source,
+                      p.sourceLength) != 0)
+        continue;
+      matches.push_back({outputs[k], static_cast<uint32_t>(begin)});
+    }
+  }
+  if (matches.empty())
+    return std::string(input);
+
+  // Same precedence as applying the patterns one after the other
+  std::sort(matches.begin(), matches.end(),
+            [](const Match& l, const Match& r) {
+              return l.pattern != r.pattern ? l.pattern < r.pattern
+                                            : l.begin < r.begin;
+            });
+  std::vector<char> taken(input.size(), 0);
+  std::vector<Match> kept;
+  for (const Match& m : matches) {
+    const uint32_t length = info[m.pattern].sourceLength;
+    if (std::find(taken.begin() + m.begin, taken.begin() + m.begin + length,
+                  1) != taken.begin() + m.begin + length)
+      continue;
+    std::fill_n(taken.begin() + m.begin, length, 1);
+    kept.push_back(m);
+  }
+  std::sort(kept.begin(), kept.end(), [](const Match& l, const Match& r) {
+    return l.begin < r.begin;
+  });
+
+  std::string output;
+  output.reserve(input.size());
+  size_t copied = 0;
+  for (const Match& m : kept) {
+    const Info& p = info[m.pattern];
+    output.append(input.data() + copied, m.begin - copied);
+    output.append(strings + p.replacement, p.replacementLength);
+    copied = m.begin + p.sourceLength;
+  }
+  output.append(input.data() + copied, input.size() - copied);
+  return output;
+}
+
+} // namespace Explorer
+
+} // namespace TitleFinder
@@ -0,0 +1,127 @@
+/**
+ * @file explorer/ahocorasick.hpp
+ *
+ * @brief Multi-pattern literal replacement
+ *
+ * @author Jordan Bieder
+ *
+ * @copyright Copyright (C) 2023 Jordan Bieder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace TitleFinder {
+
+namespace Explorer {
+
+/**
+ * Aho-Corasick automaton replacing many literals in a single pass.
+ *
+ * Transitions are fully resolved (a DFA) over classes of bytes: bytes that
+ * appear in no pattern share one class, and case folding is done by the
+ * byte to class table. Case sensitive patterns are folded in the automaton
+ * and checked against the input when they match.
+ *
+ * Everything lives in one flat block of 32 bits words: a header, the byte
+ * classes, the transitions, the outputs of each state (patterns ending
+ * there, failure chain included), the pattern table and the strings.
+ * The block is saved as is and mapped back without any decoding.
+ */
+class AhoCorasick {
+
+public:
+  struct Pattern {
+    std::string source;
+    std::string replacement;
+    bool caseSensitive;
+  };
+
+  /**
+   * Automaton matching nothing.
+   */
+  AhoCorasick();
+
+  explicit AhoCorasick(const std::vector<Pattern>& patterns);
+
+  AhoCorasick(const AhoCorasick&) = delete;
+  AhoCorasick& operator=(const AhoCorasick&) = delete;
+  AhoCorasick(AhoCorasick&& other) noexcept;
+  AhoCorasick& operator=(AhoCorasick&& other) noexcept;
+
+  /**
+   * Destructor
+   */
+  virtual ~AhoCorasick();
+
+  /**
+   * Write the automaton to file, atomically.
+   */
+  void save(const std::filesystem::path& file) const;
+
+  /**
+   * Replace this automaton with the one saved in file, mapped read only.
+   * @return false (and nothing changes) if file is missing or invalid.
+   */
+  bool map(const std::filesystem::path& file);
+
+  /**
+   * Replace the matches of input.
+   * Earlier patterns have precedence: a match is dropped if it overlaps
+   * a match of an earlier pattern, or an earlier match of the same
+   * pattern. Replacements are not scanned again.
+   */
+  std::string replace(std::string_view input) const;
+
+  size_t states() const;
+
+  size_t patterns() const;
+
+private:
+  struct Header;
+  struct Info;
+
+  inline const Header* header() const {
+    return reinterpret_cast<const Header*>(_data);
+  }
+  static size_t size(const Header* h);
+  void release();
+
+  /**
+   * @return true if every index of the block stays within its section.
+   */
+  bool isValid() const;
+  const uint32_t* transitions() const;
+  const uint32_t* outputStart() const;
+  const uint32_t* outputs() const;
+  const Info* infos() const;
+  const char* strings() const;
+
+  std::vector<uint32_t> _storage;
+  const char* _data;
+  void* _mapping;
+  size_t _mapped;
+};
+
+} // namespace Explorer
+
+} // namespace TitleFinder
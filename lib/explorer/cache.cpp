@@ -0,0 +1,432 @@
+/**
+ * @file explorer/cache.cpp
+ *
+ * @brief Atomic writes and advisory locking of cache entries
+ *
+ * @author Jordan Bieder
+ *
+ * @copyright Copyright (C) 2023 Jordan Bieder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "explorer/cache.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "explorer/logger.hpp"
+#include "explorer/sharedcache.hpp"
+
+using json = nlohmann::json;
+
+namespace {
+
+constexpr std::string_view kLockSuffix = ".lock";
+constexpr std::string_view kTmpSuffix = ".tmp";
+
+std::string uniqueSuffix() {
+  char host[64] = {0};
+  if (::gethostname(host, sizeof(host) - 1) != 0)
+    host[0] = '\0';
+  return fmt::format(
+      ".{}.{}.{:x}", host, ::getpid(),
+      std::hash<std::thread::id>{}(std::this_thread::get_id()));
+}
+
+bool writeAll(int fd, const std::string& content) {
+  const char* data = content.data();
+  size_t left = content.size();
+  while (left > 0) {
+    ssize_t n = ::write(fd, data, left);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += n;
+    left -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+/**
+ * Write content next to p and make it durable.
+ * @return The temporary file to rename.
+ */
+std::filesystem::path writeTemporary(const std::filesystem::path& p,
+                                     const std::string& content) {
+  if (p.has_parent_path())
+    std::filesystem::create_directories(p.parent_path());
+  std::filesystem::path tmp = p;
+  tmp += uniqueSuffix();
+  tmp += kTmpSuffix;
+  int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+    throw std::runtime_error(fmt::format("Unable to create {}: {}",
+                                         tmp.string(), std::strerror(errno)));
+#ifdef __linux__
+  const bool ok = writeAll(fd, content) && ::fdatasync(fd) == 0;
+#else
+  const bool ok = writeAll(fd, content) && ::fsync(fd) == 0;
+#endif
+  const int err = errno;
+  ::close(fd);
+  if (!ok) {
+    ::unlink(tmp.c_str());
+    throw std::runtime_error(fmt::format("Unable to write {}: {}",
+                                         tmp.string(), std::strerror(err)));
+  }
+  return tmp;
+}
+
+/**
+ * Make the renames of a batch durable: one fsync per directory, the files
+ * themselves were synced by writeTemporary.
+ */
+void syncDirectories(const std::vector<std::filesystem::path>& files) {
+  std::vector<std::filesystem::path> synced;
+  for (const auto& f : files) {
+    if (f.empty())
+      continue;
+    auto dir = f.parent_path();
+    if (std::find(synced.begin(), synced.end(), dir) != synced.end())
+      continue;
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+      continue;
+    ::fsync(fd);
+    ::close(fd);
+    synced.push_back(std::move(dir));
+  }
+}
+
+} // namespace
+
+namespace TitleFinder {
+
+namespace Explorer {
+
+/**
+ * Bounded write-behind queue drained by one background thread.
+ */
+class Cache::Writer {
+public:
+  struct Entry {
+    std::filesystem::path path;
+    nlohmann::json content;
+    Cache::Lock lock;
+  };
+
+  Writer()
+      : _mutex(), _work(), _done(), _queue(), _batch(), _stop(false),
+        _thread() {}
+
+  ~Writer() {
+    {
+      std::lock_guard<std::mutex> guard(_mutex);
+      _stop = true;
+    }
+    _work.notify_all();
+    if (_thread.joinable())
+      _thread.join();
+  }
+
+  void push(Entry&& entry) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (!_thread.joinable())
+      _thread = std::thread(&Writer::run, this);
+    auto it = std::find_if(
+        _queue.begin(), _queue.end(),
+        [&entry](const Entry& e) { return e.path == entry.path; });
+    if (it != _queue.end()) {
+      *it = std::move(entry);
+      return;
+    }
+    _done.wait(lock, [this] { return _queue.size() < kQueueCapacity; });
+    _queue.push_back(std::move(entry));
+    lock.unlock();
+    _work.notify_one();
+  }
+
+  bool find(const std::filesystem::path& p, nlohmann::json& j) const {
+    std::lock_guard<std::mutex> guard(_mutex);
+    auto match = [&p](const Entry& e) { return e.path == p; };
+    auto it = std::find_if(_queue.rbegin(), _queue.rend(), match);
+    if (it != _queue.rend()) {
+      j = it->content;
+      return true;
+    }
+    auto bt = std::find_if(_batch.begin(), _batch.end(), match);
+    if (bt != _batch.end()) {
+      j = bt->content;
+      return true;
+    }
+    return false;
+  }
+
+  void flush() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done.wait(lock, [this] { return _queue.empty() && _batch.empty(); });
+  }
+
+private:
+  void run() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+      _work.wait(lock, [this] { return _stop || !_queue.empty(); });
+      if (_queue.empty())
+        return;
+      _batch.assign(std::make_move_iterator(_queue.begin()),
+                    std::make_move_iterator(_queue.end()));
+      _queue.clear();
+      lock.unlock();
+      _done.notify_all();
+
+      // _batch is only read here while other threads may read it in find()
+      std::vector<std::filesystem::path> tmps(_batch.size());
+      for (size_t i = 0; i < _batch.size(); ++i) {
+        try {
+          tmps[i] = writeTemporary(_batch[i].path, _batch[i].content.dump());
+        } catch (const std::exception& e) {
+          Logger()->warn("Unable to cache {}: {}", _batch[i].path.string(),
+                         e.what());
+        }
+      }
+      for (size_t i = 0; i < _batch.size(); ++i) {
+        if (tmps[i].empty())
+          continue;
+        if (::rename(tmps[i].c_str(), _batch[i].path.c_str()) != 0) {
+          Logger()->warn("Unable to cache {}: {}", _batch[i].path.string(),
+                         std::strerror(errno));
+          ::unlink(tmps[i].c_str());
+          tmps[i].clear();
+        } else {
+          Logger()->trace("Cache file {} written", _batch[i].path.string());
+        }
+      }
+      syncDirectories(tmps);
+      Logger()->debug("{} cache files written", _batch.size());
+
+      lock.lock();
+      // Releases the entry locks now that the files are in place
+      _batch.clear();
+      _done.notify_all();
+    }
+  }
+
+  mutable std::mutex _mutex;
+  std::condition_variable _work;
+  std::condition_variable _done;
+  std::deque<Entry> _queue;
+  std::vector<Entry> _batch;
+  bool _stop;
+  std::thread _thread;
+};
+
+Cache::Lock::Lock(Lock&& other) noexcept
+    : _fd(other._fd), _path(std::move(other._path)) {
+  other._fd = -1;
+}
+
+Cache::Lock& Cache::Lock::operator=(Lock&& other) noexcept {
+  if (this != &other) {
+    this->unlock();
+    _fd = other._fd;
+    _path = std::move(other._path);
+    other._fd = -1;
+  }
+  return *this;
+}
+
+Cache::Lock::~Lock() { this->unlock(); }
+
+void Cache::Lock::unlock() {
+  if (_fd >= 0) {
+    // Removed while still held: a waiter on this file sees it unlinked
+    // once it gets the lock and starts over with a new one
+    ::unlink(_path.c_str());
+    // Closing the descriptor releases the lock
+    ::close(_fd);
+    _fd = -1;
+  }
+}
+
+Cache::Cache()
+    : _directory(), _writer(std::make_unique<Writer>()), _shared(nullptr) {}
+
+Cache::~Cache() = default;
+
+void Cache::setDirectory(const std::filesystem::path& directory) {
+  _directory = directory;
+}
+
+void Cache::useSharedMemory(bool use) {
+  if (!use) {
+    _shared.reset();
+    return;
+  }
+  if (!_shared) {
+    _shared = std::make_unique<SharedCache>(SharedCache::defaultName());
+    if (!_shared->isOpen())
+      _shared.reset();
+  }
+}
+
+Cache::Lock Cache::lock(const std::filesystem::path& key) const {
+  if (_directory.empty())
+    return Lock();
+  return lockFile(_directory / key);
+}
+
+Cache::Lock Cache::lockFile(const std::filesystem::path& file) {
+  std::filesystem::path p = file;
+  p += kLockSuffix;
+  std::error_code ec;
+  std::filesystem::create_directories(p.parent_path(), ec);
+  while (true) {
+    int fd = ::open(p.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+      Logger()->debug("Unable to open lock file {}: {}", p.string(),
+                      std::strerror(errno));
+      return Lock();
+    }
+#ifdef F_OFD_SETLKW
+    // OFD locks belong to the open file description: they exclude threads
+    // of the same process and are forwarded to the server on NFS.
+    struct flock fl;
+    std::memset(&fl, 0, sizeof(fl));
+    fl.l_type = F_WRLCK;
+    fl.l_whence = SEEK_SET;
+    int rc;
+    while ((rc = ::fcntl(fd, F_OFD_SETLKW, &fl)) != 0 && errno == EINTR)
+      ;
+#else
+    int rc;
+    while ((rc = ::flock(fd, LOCK_EX)) != 0 && errno == EINTR)
+      ;
+#endif
+    if (rc != 0) {
+      Logger()->debug("Unable to lock {}: {}", p.string(),
+                      std::strerror(errno));
+      ::close(fd);
+      return Lock();
+    }
+    // The previous holder may have removed the file meanwhile
+    struct stat opened;
+    struct stat linked;
+    if (::fstat(fd, &opened) == 0 && ::stat(p.c_str(), &linked) == 0 &&
+        opened.st_dev == linked.st_dev && opened.st_ino == linked.st_ino) {
+      Logger()->trace("Locked {}", p.string());
+      return Lock(fd, std::move(p));
+    }
+    ::close(fd);
+  }
+}
+
+bool Cache::load(const std::filesystem::path& key, json& j,
+                 std::chrono::hours maxAge) const {
+  if (_directory.empty())
+    return false;
+  const std::filesystem::path p = _directory / key;
+  if (_writer->find(p, j))
+    return true;
+  if (this->loadShared(key.generic_string(), j, maxAge))
+    return true;
+  std::error_code ec;
+  auto write = std::filesystem::last_write_time(p, ec);
+  if (ec)
+    return false;
+  auto age = std::filesystem::file_time_type::clock::now() - write;
+  if (std::chrono::duration_cast<std::chrono::hours>(age) > maxAge) {
+    Logger()->debug("Cache file {} is outdated", p.string());
+    return false;
+  }
+  std::ifstream file(p, std::ios::in);
+  if (!file.is_open())
+    return false;
+  try {
+    j = json::parse(file);
+  } catch (const std::exception& e) {
+    Logger()->error("Failed to load cache file {} with: {} ", p.string(),
+                    e.what());
+    return false;
+  }
+  // Keep the age of the file, the entry must expire with it
+  this->storeShared(key.generic_string(), j,
+                    std::chrono::system_clock::now() -
+                        std::chrono::duration_cast<
+                            std::chrono::system_clock::duration>(age));
+  return true;
+}
+
+void Cache::store(const std::filesystem::path& key, const json& j,
+                  Lock&& lock) const {
+  if (_directory.empty())
+    return;
+  this->storeShared(key.generic_string(), j);
+  _writer->push(Writer::Entry{_directory / key, j, std::move(lock)});
+}
+
+void Cache::flush() const { _writer->flush(); }
+
+void atomicWrite(const std::filesystem::path& p, const std::string& content) {
+  const std::filesystem::path tmp = writeTemporary(p, content);
+  if (::rename(tmp.c_str(), p.c_str()) != 0) {
+    const int err = errno;
+    ::unlink(tmp.c_str());
+    throw std::runtime_error(fmt::format("Unable to write {}: {}", p.string(),
+                                         std::strerror(err)));
+  }
+}
+
+bool Cache::loadShared(std::string_view key, json& j,
+                       std::chrono::hours maxAge) const {
+  if (!_shared)
+    return false;
+  std::string value;
+  if (!_shared->get(key, value, maxAge))
+    return false;
+  try {
+    j = json::parse(value);
+  } catch (const std::exception& e) {
+    Logger()->debug("Ignoring corrupted shared entry {}", key);
+    return false;
+  }
+  Logger()->trace("Shared cache hit for {}", key);
+  return true;
+}
+
+void Cache::storeShared(std::string_view key, const json& j,
+                        std::chrono::system_clock::time_point written) const {
+  if (_shared && !_shared->put(key, j.dump(), written))
+    Logger()->trace("Entry {} not shared", key);
+}
+
+} // namespace Explorer
+
+} // namespace TitleFinder
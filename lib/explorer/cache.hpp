@@ -0,0 +1,166 @@
+/**
+ * @file explorer/cache.hpp
+ *
+ * @brief On disk cache of TMDB responses shared between processes
+ *
+ * @author Jordan Bieder
+ *
+ * @copyright Copyright (C) 2023 Jordan Bieder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace TitleFinder {
+
+namespace Explorer {
+
+class SharedCache;
+
+class Cache {
+
+public:
+  /**
+   * Advisory lock on one cache entry.
+   * The lock is held by an open file description so it excludes other
+   * threads as well as other processes (including over NFS).
+   * The lock file is removed on release, still locked, so the cache does
+   * not keep one per entry.
+   */
+  class Lock {
+  public:
+    Lock() : _fd(-1), _path() {}
+    Lock(Lock&& other) noexcept;
+    Lock& operator=(Lock&& other) noexcept;
+    Lock(const Lock&) = delete;
+    Lock& operator=(const Lock&) = delete;
+    ~Lock();
+
+    inline bool owns() const { return _fd >= 0; }
+
+    void unlock();
+
+  private:
+    Lock(int fd, std::filesystem::path path)
+        : _fd(fd), _path(std::move(path)) {}
+    int _fd;
+    std::filesystem::path _path;
+
+    friend class Cache;
+  };
+
+  /**
+   * Empty constructor
+   */
+  Cache();
+
+  Cache(const Cache&) = delete;
+  Cache& operator=(const Cache&) = delete;
+
+  /**
+   * Destructor
+   * Pending writes are flushed before returning.
+   */
+  virtual ~Cache();
+
+  void setDirectory(const std::filesystem::path& directory);
+
+  inline const std::filesystem::path& getDirectory() const {
+    return _directory;
+  }
+
+  inline bool isValid() const { return !_directory.empty(); }
+
+  /**
+   * Also keep entries in a shared memory segment so that other running
+   * processes find them without touching the disk or the network.
+   */
+  void useSharedMemory(bool use);
+
+  /**
+   * Take an exclusive lock on key.
+   * Blocks until every other holder released it. If locking is not possible
+   * an empty lock is returned and the caller simply runs unprotected.
+   */
+  Lock lock(const std::filesystem::path& key) const;
+
+  /**
+   * Same as lock() for any file p, through p.lock.
+   */
+  static Lock lockFile(const std::filesystem::path& p);
+
+  /**
+   * Read key if it exists and is younger than maxAge.
+   * Entries still waiting in the write-behind queue are returned as well.
+   * @return true if j was filled.
+   */
+  bool load(const std::filesystem::path& key, nlohmann::json& j,
+            std::chrono::hours maxAge = kDefaultMaxAge) const;
+
+  /**
+   * Queue key for writing by the background writer and return immediately.
+   * The entry is written through a temporary file atomically renamed into
+   * place so readers never see a partially written entry. If a lock is
+   * given it is released only once the entry is on disk.
+   * Blocks when kQueueCapacity entries are already waiting.
+   */
+  void store(const std::filesystem::path& key, const nlohmann::json& j,
+             Lock&& lock = Lock()) const;
+
+  /**
+   * Wait until every queued entry has been written.
+   */
+  void flush() const;
+
+  /**
+   * Read an entry that only lives in shared memory.
+   */
+  bool loadShared(std::string_view key, nlohmann::json& j,
+                  std::chrono::hours maxAge = kDefaultMaxAge) const;
+
+  /**
+   * Publish an entry to shared memory only, aged from written.
+   */
+  void storeShared(std::string_view key, const nlohmann::json& j,
+                   std::chrono::system_clock::time_point written =
+                       std::chrono::system_clock::now()) const;
+
+  static constexpr std::chrono::hours kDefaultMaxAge{24 * 6};
+  static constexpr size_t kQueueCapacity = 64;
+
+private:
+  class Writer;
+
+  std::filesystem::path _directory;
+  std::unique_ptr<Writer> _writer;
+  std::unique_ptr<SharedCache> _shared;
+};
+
+/**
+ * Durably replace p with content through a temporary file and a rename.
+ */
+void atomicWrite(const std::filesystem::path& p, const std::string& content);
+
+} // namespace Explorer
+
+} // namespace TitleFinder
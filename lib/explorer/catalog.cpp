@@ -0,0 +1,356 @@
+/**
+ * @file explorer/catalog.cpp
+ *
+ * @brief Local title catalog built from TMDB daily exports
+ *
+ * @author Jordan Bieder
+ *
+ * @copyright Copyright (C) 2023 Jordan Bieder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "explorer/catalog.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <nlohmann/json.hpp>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "explorer/cache.hpp"
+#include "explorer/levenshtein.hpp"
+#include "explorer/logger.hpp"
+#include "explorer/normalize.hpp"
+
+namespace {
+
+constexpr uint64_t kMagic = 0x474c544143465431ULL; // 1TFCATLG
+constexpr uint32_t kVersion = 1;
+constexpr size_t kBuckets = 1 << 16;
+
+inline size_t bucket(std::string_view key) {
+  const auto first = key.size() > 0 ? static_cast<unsigned char>(key[0]) : 0;
+  const auto second = key.size() > 1 ? static_cast<unsigned char>(key[1]) : 0;
+  return static_cast<size_t>(first) << 8 | second;
+}
+
+/**
+ * Call f on each line of a gzip'd (or plain) file.
+ */
+template <class F> void readLines(const std::filesystem::path& file, F&& f) {
+  gzFile gz = ::gzopen(file.c_str(), "rb");
+  if (gz == nullptr)
+    throw std::runtime_error(fmt::format("Unable to open {}", file.string()));
+  ::gzbuffer(gz, 1 << 17);
+  std::string line;
+  char buffer[4096];
+  while (::gzgets(gz, buffer, sizeof(buffer)) != nullptr) {
+    line.append(buffer);
+    if (line.back() != '\n' && !::gzeof(gz))
+      continue;
+    f(line);
+    line.clear();
+  }
+  int error = Z_OK;
+  const char* message = ::gzerror(gz, &error);
+  ::gzclose(gz);
+  if (error != Z_OK && error != Z_STREAM_END)
+    throw std::runtime_error(
+        fmt::format("Unable to read {}: {}", file.string(), message));
+}
+
+} // namespace
+
+namespace TitleFinder {
+
+namespace Explorer {
+
+struct Catalog::Header {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t count;
+  uint64_t strings; ///< offset of the string pool
+  uint32_t index[kBuckets + 1];
+};
+
+struct Catalog::Record {
+  uint32_t offset; ///< of the key in the string pool, followed by the name
+  uint32_t id;
+  float popularity;
+  uint16_t keyLength;
+  uint16_t nameLength;
+  uint8_t type;
+  uint8_t reserved[3];
+};
+
+Catalog::Catalog(const std::filesystem::path& file)
+    : _data(nullptr), _size(0), _indexed(), _indexes() {
+  int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    Logger()->debug("No catalog {}: {}", file.string(), std::strerror(errno));
+    return;
+  }
+  struct stat st;
+  if (::fstat(fd, &st) != 0 ||
+      static_cast<size_t>(st.st_size) < sizeof(Header)) {
+    Logger()->warn("Catalog {} is truncated", file.string());
+    ::close(fd);
+    return;
+  }
+  const size_t size = static_cast<size_t>(st.st_size);
+  void* p = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED) {
+    Logger()->warn("Unable to map catalog {}: {}", file.string(),
+                   std::strerror(errno));
+    return;
+  }
+  const auto* h = static_cast<const Header*>(p);
+  // Every offset read later must stay within the mapping
+  auto valid = [h, size] {
+    const size_t records =
+        sizeof(Header) + static_cast<size_t>(h->count) * sizeof(Record);
+    if (h->magic != kMagic || h->version != kVersion ||
+        h->strings < records || h->strings > size ||
+        h->index[kBuckets] != h->count)
+      return false;
+    for (size_t b = 0; b < kBuckets; ++b) {
+      if (h->index[b] > h->index[b + 1])
+        return false;
+    }
+    const size_t pool = size - h->strings;
+    const auto* r = reinterpret_cast<const Record*>(
+        reinterpret_cast<const char*>(h) + sizeof(Header));
+    for (uint32_t i = 0; i < h->count; ++i) {
+      const size_t end =
+          static_cast<size_t>(r[i].offset) + r[i].keyLength + r[i].nameLength;
+      if (end > pool || r[i].type > static_cast<uint8_t>(Type::Show))
+        return false;
+    }
+    return true;
+  };
+  if (!valid()) {
+    Logger()->warn("Catalog {} is not valid", file.string());
+    ::munmap(p, size);
+    return;
+  }
+  ::madvise(p, size, MADV_RANDOM);
+  _data = static_cast<const char*>(p);
+  _size = size;
+  Logger()->debug("Catalog {} mapped ({} titles)", file.string(), h->count);
+}
+
+Catalog::~Catalog() {
+  if (_data)
+    ::munmap(const_cast<char*>(_data), _size);
+}
+
+const Catalog::Header* Catalog::header() const {
+  return reinterpret_cast<const Header*>(_data);
+}
+
+const Catalog::Record* Catalog::records() const {
+  return reinterpret_cast<const Record*>(_data + sizeof(Header));
+}
+
+std::string_view Catalog::key(const Record& r) const {
+  return std::string_view(_data + this->header()->strings + r.offset,
+                          r.keyLength);
+}
+
+Catalog::Entry Catalog::entry(const Record& r) const {
+  const char* name = _data + this->header()->strings + r.offset + r.keyLength;
+  return {r.id, static_cast<Type>(r.type), r.popularity,
+          std::string_view(name, r.nameLength)};
+}
+
+size_t Catalog::size() const { return _data ? header()->count : 0; }
+
+std::vector<Catalog::Entry> Catalog::find(Type t,
+                                          std::string_view title) const {
+  std::vector<Entry> entries;
+  if (!_data)
+    return entries;
+  const std::string key = normalizeTitle(title);
+  const Header* h = this->header();
+  const char* strings = _data + h->strings;
+  const size_t b = bucket(key);
+  const Record* first = this->records() + h->index[b];
+  const Record* last = this->records() + h->index[b + 1];
+  struct Compare {
+    const char* strings;
+    inline std::string_view key(const Record& r) const {
+      return std::string_view(strings + r.offset, r.keyLength);
+    }
+    bool operator()(const Record& l, std::string_view r) const {
+      return key(l) < r;
+    }
+    bool operator()(std::string_view l, const Record& r) const {
+      return l < key(r);
+    }
+  };
+  const auto range =
+      std::equal_range(first, last, std::string_view(key), Compare{strings});
+  for (const Record* r = range.first; r != range.second; ++r) {
+    if (r->type == static_cast<uint8_t>(t))
+      entries.push_back(this->entry(*r));
+  }
+  // Records with the same key are already sorted by popularity
+  return entries;
+}
+
+const TrigramIndex& Catalog::index(Type t) const {
+  const auto slot = static_cast<size_t>(t);
+  std::call_once(_indexed[slot], [this, t, slot] {
+    const Header* h = this->header();
+    const Record* r = this->records();
+    auto index = std::make_unique<TrigramIndex>();
+    std::string_view previous;
+    for (uint32_t i = 0; i < h->count; ++i) {
+      if (r[i].type != static_cast<uint8_t>(t))
+        continue;
+      // Only the first (most popular) record of each name is indexed
+      const std::string_view key = this->key(r[i]);
+      if (key == previous)
+        continue;
+      index->add(i, key);
+      previous = key;
+    }
+    index->build();
+    Logger()->debug("Trigram index of type {} built ({} trigrams)", slot,
+                    index->size());
+    _indexes[slot] = std::move(index);
+  });
+  return *_indexes[slot];
+}
+
+std::vector<Catalog::Match>
+Catalog::search(Type t, std::string_view title, unsigned maxDistance) const {
+  std::vector<Match> matches;
+  if (!_data || (t != Type::Movie && t != Type::Show))
+    return matches;
+  const std::string key = normalizeTitle(title);
+  const uint32_t count = this->header()->count;
+  const Record* r = this->records();
+  for (uint32_t id : this->index(t).candidates(key, maxDistance)) {
+    const std::string_view name = this->key(r[id]);
+    const unsigned distance =
+        Levenshtein(key, std::string(name), maxDistance);
+    if (distance > maxDistance)
+      continue;
+    // Every record with this name follows the indexed one
+    for (uint32_t i = id;
+         i < count && r[i].type == r[id].type && this->key(r[i]) == name; ++i)
+      matches.push_back({this->entry(r[i]), distance});
+  }
+  std::sort(matches.begin(), matches.end(),
+            [](const Match& l, const Match& r) {
+              if (l.distance != r.distance)
+                return l.distance < r.distance;
+              return l.entry.popularity > r.entry.popularity;
+            });
+  return matches;
+}
+
+size_t Catalog::import(
+    const std::vector<std::pair<Type, std::filesystem::path>>& exports,
+    const std::filesystem::path& output) {
+  struct Item {
+    std::string key;
+    std::string name;
+    uint32_t id;
+    float popularity;
+    Type type;
+  };
+  std::vector<Item> items;
+  for (const auto& [type, file] : exports) {
+    const char* field =
+        type == Type::Movie ? "original_title" : "original_name";
+    const size_t before = items.size();
+    readLines(file, [&](const std::string& line) {
+      if (line.find_first_not_of(" \r\n") == std::string::npos)
+        return;
+      try {
+        const auto j = nlohmann::json::parse(line);
+        if (j.value("adult", false) || j.value("video", false))
+          return;
+        std::string name = j.value(field, "");
+        std::string key = normalizeTitle(name);
+        if (key.empty() || key.size() + name.size() > UINT16_MAX)
+          return;
+        items.push_back({std::move(key), std::move(name),
+                         j.at("id").get<uint32_t>(),
+                         j.value("popularity", 0.f), type});
+      } catch (const std::exception& e) {
+        Logger()->debug("Skipping line of {}: {}", file.string(), e.what());
+      }
+    });
+    Logger()->info("Read {} titles from {}", items.size() - before,
+                   file.string());
+  }
+
+  std::sort(items.begin(), items.end(), [](const Item& l, const Item& r) {
+    if (l.key != r.key)
+      return l.key < r.key;
+    if (l.type != r.type)
+      return l.type < r.type;
+    return l.popularity > r.popularity;
+  });
+
+  std::string content(sizeof(Header) + items.size() * sizeof(Record), '\0');
+  auto* h = reinterpret_cast<Header*>(content.data());
+  h->magic = kMagic;
+  h->version = kVersion;
+  h->count = static_cast<uint32_t>(items.size());
+  h->strings = content.size();
+  std::string strings;
+  size_t b = 0;
+  for (size_t i = 0; i < items.size(); ++i) {
+    const Item& item = items[i];
+    for (const size_t next = bucket(item.key); b <= next; ++b)
+      h->index[b] = static_cast<uint32_t>(i);
+    if (strings.size() > UINT32_MAX - item.key.size() - item.name.size())
+      throw std::runtime_error("Catalog is too large");
+    Record r{};
+    r.offset = static_cast<uint32_t>(strings.size());
+    r.id = item.id;
+    r.popularity = item.popularity;
+    r.keyLength = static_cast<uint16_t>(item.key.size());
+    r.nameLength = static_cast<uint16_t>(item.name.size());
+    r.type = static_cast<uint8_t>(item.type);
+    std::memcpy(content.data() + sizeof(Header) + i * sizeof(Record), &r,
+                sizeof(r));
+    strings += item.key;
+    strings += item.name;
+  }
+  for (; b <= kBuckets; ++b)
+    h->index[b] = static_cast<uint32_t>(items.size());
+  content += strings;
+
+  atomicWrite(output, content);
+  Logger()->info("Catalog {} written with {} titles", output.string(),
+                 items.size());
+  return items.size();
+}
+
+} // namespace Explorer
+
+} // namespace TitleFinder
@@ -0,0 +1,120 @@
+/**
+ * @file explorer/catalog.hpp
+ *
+ * @brief Local title catalog built from TMDB daily exports
+ *
+ * @author Jordan Bieder
+ *
+ * @copyright Copyright (C) 2023 Jordan Bieder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+#include "explorer/discriminator.hpp"
+#include "explorer/trigram.hpp"
+
+namespace TitleFinder {
+
+namespace Explorer {
+
+/**
+ * Read only view of a catalog file.
+ * Titles are sorted by normalized name and indexed by their first two bytes
+ * so that a lookup is a bucket access followed by a short binary search,
+ * straight from the memory mapped file.
+ */
+class Catalog {
+
+public:
+  struct Entry {
+    uint32_t id;
+    Type type;
+    float popularity;
+    std::string_view name; ///< points into the mapping
+  };
+
+  struct Match {
+    Entry entry;
+    unsigned distance; ///< between normalized names
+  };
+
+  /**
+   * Map file. isOpen() tells if it worked.
+   */
+  explicit Catalog(const std::filesystem::path& file);
+
+  Catalog(const Catalog&) = delete;
+  Catalog& operator=(const Catalog&) = delete;
+
+  /**
+   * Destructor
+   */
+  virtual ~Catalog();
+
+  inline bool isOpen() const { return _data != nullptr; }
+
+  size_t size() const;
+
+  /**
+   * All titles of type t whose normalized name is the one of title,
+   * most popular first.
+   */
+  std::vector<Entry> find(Type t, std::string_view title) const;
+
+  /**
+   * All titles of type t within maxDistance edits of title once both are
+   * normalized, closest first then most popular.
+   * Candidates come from a trigram index of type t built on first use.
+   */
+  std::vector<Match> search(Type t, std::string_view title,
+                            unsigned maxDistance) const;
+
+  /**
+   * Build a catalog file from TMDB daily id exports (gzip'd or plain
+   * NDJSON). Each export is read as a list of type t.
+   * @return the number of titles written.
+   */
+  static size_t
+  import(const std::vector<std::pair<Type, std::filesystem::path>>& exports,
+         const std::filesystem::path& output);
+
+private:
+  struct Header;
+  struct Record;
+
+  const Header* header() const;
+  const Record* records() const;
+  std::string_view key(const Record& r) const;
+  Entry entry(const Record& r) const;
+  const TrigramIndex& index(Type t) const;
+
+  const char* _data;
+  size_t _size;
+  // Movies and shows
+  mutable std::once_flag _indexed[2];
+  mutable std::unique_ptr<TrigramIndex> _indexes[2];
+};
+
+} // namespace Explorer
+
+} // namespace TitleFinder
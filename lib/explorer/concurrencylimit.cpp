@@ -0,0 +1,147 @@
+/**
+ * @file explorer/concurrencylimit.cpp
+ *
+ * @brief Adaptive concurrency of a pool of workers
+ *
+ * @author Jordan Bieder
+ *
+ * @copyright Copyright (C) 2023 Jordan Bieder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "explorer/concurrencylimit.hpp"
+
+#include <algorithm>
+#include <utility>
+
+#include "explorer/logger.hpp"
+
+namespace {
+
+// A window closes after as many tasks as the limit (at least kMinWindow)
+// or after kMaxWindow with at least one task
+constexpr size_t kMinWindow = 4;
+constexpr std::chrono::milliseconds kMaxWindow{1000};
+constexpr double kDecrease = 0.7;
+// Latency this many times the best one means a queue builds up somewhere
+constexpr double kLatencyTolerance = 2.0;
+// Lost throughput that makes an increase a mistake
+constexpr double kThroughputTolerance = 0.9;
+// The best latency is forgotten slowly, the network may change
+constexpr double kLatencyAging = 1.05;
+
+} // namespace
+
+namespace TitleFinder {
+
+namespace Explorer {
+
+ConcurrencyLimit::ConcurrencyLimit(std::string name, int minimum, int maximum,
+                                   int initial)
+    : _name(std::move(name)), _minimum(std::max(minimum, 1)),
+      _maximum(std::max(maximum, _minimum)),
+      _limit(std::clamp(initial, _minimum, _maximum)), _running(0),
+      _windowStart(Clock::now()), _completed(0), _failed(0),
+      _latencySum(0), _bestLatency(0), _lastThroughput(0), _increased(false),
+      _mutex(), _available() {
+  if (_minimum < _maximum)
+    Logger()->info("{} concurrency starts at {} (between {} and {})", _name,
+                   _limit, _minimum, _maximum);
+}
+
+void ConcurrencyLimit::acquire() {
+  std::unique_lock lock(_mutex);
+  _available.wait(lock, [this] { return _running < _limit; });
+  ++_running;
+}
+
+void ConcurrencyLimit::release(Clock::duration latency, bool failed) {
+  std::lock_guard lock(_mutex);
+  --_running;
+  if (_minimum < _maximum) {
+    ++_completed;
+    if (failed)
+      ++_failed;
+    _latencySum += std::chrono::duration<double>(latency).count();
+    const auto now = Clock::now();
+    if (_completed >= std::max<size_t>(_limit, kMinWindow) ||
+        now - _windowStart >= kMaxWindow)
+      this->decide(now);
+  }
+  _available.notify_one();
+}
+
+void ConcurrencyLimit::release() {
+  std::lock_guard lock(_mutex);
+  --_running;
+  _available.notify_one();
+}
+
+int ConcurrencyLimit::limit() const {
+  std::lock_guard lock(_mutex);
+  return _limit;
+}
+
+void ConcurrencyLimit::decide(Clock::time_point now) {
+  const double elapsed =
+      std::max(std::chrono::duration<double>(now - _windowStart).count(),
+               1e-6);
+  const double throughput = static_cast<double>(_completed) / elapsed;
+  const double latency = _latencySum / static_cast<double>(_completed);
+  _bestLatency = _bestLatency > 0
+                     ? std::min(latency, _bestLatency * kLatencyAging)
+                     : latency;
+
+  const int previous = _limit;
+  const char* reason = nullptr;
+  if (_failed > 0)
+    reason = "errors";
+  else if (latency > kLatencyTolerance * _bestLatency)
+    reason = "latency";
+  else if (_increased && throughput < kThroughputTolerance * _lastThroughput)
+    reason = "throughput";
+
+  if (reason != nullptr) {
+    const int decreased = static_cast<int>(_limit * kDecrease);
+    _limit = std::max(_minimum, std::min(_limit - 1, decreased));
+  } else if (_limit < _maximum) {
+    ++_limit;
+    reason = "increase";
+  }
+  _increased = _limit > previous;
+
+  if (_limit != previous) {
+    Logger()->info("{} concurrency {} -> {} ({}): {:.1f} tasks/s, {:.0f} ms "
+                   "mean latency, {} errors",
+                   _name, previous, _limit, reason, throughput,
+                   latency * 1000, _failed);
+    if (_limit > previous)
+      _available.notify_all();
+  } else {
+    Logger()->debug("{} concurrency stays {}: {:.1f} tasks/s, {:.0f} ms mean "
+                    "latency, {} errors",
+                    _name, _limit, throughput, latency * 1000, _failed);
+  }
+
+  _lastThroughput = throughput;
+  _windowStart = now;
+  _completed = 0;
+  _failed = 0;
+  _latencySum = 0;
+}
+
+} // namespace Explorer
+
+} // namespace TitleFinder
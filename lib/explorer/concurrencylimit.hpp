@@ -0,0 +1,105 @@
+/**
+ * @file explorer/concurrencylimit.hpp
+ *
+ * @brief Adaptive concurrency of a pool of workers
+ *
+ * @author Jordan Bieder
+ *
+ * @copyright Copyright (C) 2023 Jordan Bieder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string>
+
+namespace TitleFinder {
+
+namespace Explorer {
+
+/**
+ * Number of tasks a pool of workers may run at the same time, adjusted
+ * from what the tasks show: one more each time a window of tasks went
+ * well (additive increase), 30% less on errors, when latency inflates far
+ * above the best seen or when the last increase lost throughput
+ * (multiplicative decrease). Each change is logged.
+ * Workers call acquire() before a task and release() after it; with
+ * minimum == maximum the limit is fixed.
+ */
+class ConcurrencyLimit {
+
+public:
+  using Clock = std::chrono::steady_clock;
+
+  ConcurrencyLimit(std::string name, int minimum, int maximum, int initial);
+
+  ConcurrencyLimit(const ConcurrencyLimit&) = delete;
+  ConcurrencyLimit& operator=(const ConcurrencyLimit&) = delete;
+
+  /**
+   * Destructor
+   */
+  virtual ~ConcurrencyLimit() = default;
+
+  /**
+   * Wait until fewer tasks than the limit run.
+   */
+  void acquire();
+
+  /**
+   * End a task that took latency and failed in a way that may come from
+   * too much concurrency (network errors, I/O errors).
+   * Latencies are compared with each other: callers give them per unit of
+   * work (per request, per byte...) when their tasks differ in size.
+   */
+  void release(Clock::duration latency, bool failed);
+
+  /**
+   * End a task that tells nothing about the load, like a cache hit or a
+   * plain rename: it frees its slot without counting in the window.
+   */
+  void release();
+
+  int limit() const;
+
+private:
+  /**
+   * Close the current window and move the limit.
+   */
+  void decide(Clock::time_point now);
+
+  std::string _name;
+  int _minimum;
+  int _maximum;
+  int _limit;
+  int _running;
+  Clock::time_point _windowStart;
+  size_t _completed;
+  size_t _failed;
+  double _latencySum;     ///< seconds
+  double _bestLatency;    ///< mean latency of the best window, aged
+  double _lastThroughput; ///< tasks per second of the previous window
+  bool _increased;
+  mutable std::mutex _mutex;
+  std::condition_variable _available;
+};
+
+} // namespace Explorer
+
+} // namespace TitleFinder
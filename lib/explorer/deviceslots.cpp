@@ -0,0 +1,119 @@
+/**
+ * @file explorer/deviceslots.cpp
+ *
+ * @brief Per device limits of concurrent disk work
+ *
+ * @author Jordan Bieder
+ *
+ * @copyright Copyright (C) 2023 Jordan Bieder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "explorer/deviceslots.hpp"
+
+#include <algorithm>
+#include <fmt/format.h>
+#include <fstream>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "explorer/logger.hpp"
+
+namespace {
+
+/**
+ * @return the st_dev of p or of its closest existing parent, 0 if none.
+ */
+uint64_t deviceOf(std::filesystem::path p) {
+  struct stat st;
+  while (::stat(p.c_str(), &st) != 0) {
+    if (!p.has_relative_path())
+      return 0;
+    p = p.parent_path();
+  }
+  return static_cast<uint64_t>(st.st_dev);
+}
+
+} // namespace
+
+namespace TitleFinder {
+
+namespace Explorer {
+
+DeviceSlots::DeviceSlots(int fastSlots, int rotationalSlots)
+    : _fastSlots(std::max(fastSlots, 1)),
+      _rotationalSlots(std::max(rotationalSlots, 1)), _devices(), _mutex() {}
+
+DeviceSlots::Devices
+DeviceSlots::devicesOf(const std::filesystem::path& source,
+                       const std::filesystem::path& destination) {
+  return Devices{deviceOf(std::filesystem::absolute(source)),
+                 deviceOf(std::filesystem::absolute(destination))};
+}
+
+bool DeviceSlots::isRotational(uint64_t device) {
+  const dev_t id = static_cast<dev_t>(device);
+  const std::string base =
+      fmt::format("/sys/dev/block/{}:{}", major(id), minor(id));
+  // A partition has no queue of its own, its disk (the parent) has
+  for (const char* queue : {"/queue/rotational", "/../queue/rotational"}) {
+    std::ifstream file(base + queue);
+    int rotational = 0;
+    if (file >> rotational)
+      return rotational != 0;
+  }
+  // Network and virtual file systems (major 0) have no block device
+  return false;
+}
+
+DeviceSlots::Device& DeviceSlots::device(uint64_t id) {
+  auto it = _devices.find(id);
+  if (it == _devices.end()) {
+    const bool rotational = id != 0 && isRotational(id);
+    const int slots = rotational ? _rotationalSlots : _fastSlots;
+    Logger()->debug("Device {}:{} is {}, {} concurrent tasks",
+                    major(static_cast<dev_t>(id)),
+                    minor(static_cast<dev_t>(id)),
+                    rotational ? "rotational" : "not rotational", slots);
+    it = _devices.emplace(id, Device{slots, 0}).first;
+  }
+  return it->second;
+}
+
+bool DeviceSlots::tryAcquire(const Devices& devices) {
+  std::lock_guard lock(_mutex);
+  Device& source = this->device(devices.source);
+  Device& destination = this->device(devices.destination);
+  if (source.used >= source.slots)
+    return false;
+  if (devices.destination != devices.source &&
+      destination.used >= destination.slots)
+    return false;
+  ++source.used;
+  if (devices.destination != devices.source)
+    ++destination.used;
+  return true;
+}
+
+void DeviceSlots::release(const Devices& devices) {
+  std::lock_guard lock(_mutex);
+  --this->device(devices.source).used;
+  if (devices.destination != devices.source)
+    --this->device(devices.destination).used;
+}
+
+} // namespace Explorer
+
+} // namespace TitleFinder
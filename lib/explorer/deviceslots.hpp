@@ -0,0 +1,100 @@
+/**
+ * @file explorer/deviceslots.hpp
+ *
+ * @brief Per device limits of concurrent disk work
+ *
+ * @author Jordan Bieder
+ *
+ * @copyright Copyright (C) 2023 Jordan Bieder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+
+namespace TitleFinder {
+
+namespace Explorer {
+
+/**
+ * How many disk heavy tasks (remuxes) may run at once on each device:
+ * one on a rotational disk, where concurrent streams only add seeks, and
+ * up to a shared limit on the others (SSD, network, unknown).
+ * Devices come from st_dev, and whether they rotate from
+ * /sys/dev/block/<major>:<minor>/queue/rotational.
+ */
+class DeviceSlots {
+
+public:
+  /**
+   * A task reads from source and writes to destination, the same device
+   * or two.
+   */
+  struct Devices {
+    uint64_t source = 0;
+    uint64_t destination = 0;
+  };
+
+  explicit DeviceSlots(int fastSlots, int rotationalSlots = 1);
+
+  DeviceSlots(const DeviceSlots&) = delete;
+  DeviceSlots& operator=(const DeviceSlots&) = delete;
+
+  /**
+   * Destructor
+   */
+  virtual ~DeviceSlots() = default;
+
+  /**
+   * Devices of a task reading source and writing destination, which may
+   * not exist yet (its closest existing folder decides).
+   */
+  static Devices devicesOf(const std::filesystem::path& source,
+                           const std::filesystem::path& destination);
+
+  /**
+   * Take a slot on each device of devices if all have one left.
+   * @return false if one of them is busy, nothing is taken.
+   */
+  bool tryAcquire(const Devices& devices);
+
+  void release(const Devices& devices);
+
+  /**
+   * @return true if device is known to be a rotational disk.
+   */
+  static bool isRotational(uint64_t device);
+
+private:
+  struct Device {
+    int slots;
+    int used;
+  };
+
+  Device& device(uint64_t id);
+
+  int _fastSlots;
+  int _rotationalSlots;
+  std::map<uint64_t, Device> _devices;
+  std::mutex _mutex;
+};
+
+} // namespace Explorer
+
+} // namespace TitleFinder
@@ -23,19 +23,133 @@
 
 #include "explorer/discriminator.hpp"
 
-#include <filesystem>
-#include <regex>
+#include <cctype>
 #include <chrono>
+#include <ctime>
+#include <string>
+#include <vector>
 
 #include "explorer/logger.hpp"
 
 namespace {
 
-constexpr const char* seasonDiscriminant_{R"([\.\-_ ][s]?(\d{1,2})$)"};
-constexpr const char* episodeDiscriminant_{
-    R"([\.\-_ ][s]?(\d{1,2})[\.\- ]?[xe](\d{1,2}))"};
-constexpr const char* movieDiscriminant_{
-    R"([\._\- ]?\(?(\d{4})[^a-zA-Z0-9]*\)?)"};
+constexpr size_t npos = std::string_view::npos;
+
+inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+inline bool isSeparator(char c) {
+  return c == '.' || c == '-' || c == '_' || c == ' ';
+}
+
+/**
+ * Read up to max digits at s[i].
+ * @return the number of digits read, value holds their value.
+ */
+size_t digits(std::string_view s, size_t i, size_t max, int& value) {
+  size_t n = 0;
+  value = 0;
+  while (n < max && i + n < s.size() && isDigit(s[i + n])) {
+    value = value * 10 + (s[i + n] - '0');
+    ++n;
+  }
+  return n;
+}
+
+/**
+ * Episode marker: a separator, an optional 's', the season on 1 or 2
+ * digits, an optional separator other than '_', then 'x' or 'e' and the
+ * episode on 1 or 2 digits (case insensitive), e.g. ".S01E02", " 1x02".
+ * @return the position of the leading separator or npos.
+ */
+size_t findEpisode(std::string_view s, int& season, int& episode) {
+  for (size_t start = 0; start < s.size(); ++start) {
+    if (!isSeparator(s[start]))
+      continue;
+    size_t i = start + 1;
+    if (i < s.size() && (s[i] == 's' || s[i] == 'S'))
+      ++i;
+    int first = 0;
+    const size_t n = digits(s, i, 2, first);
+    if (n == 0)
+      continue;
+    i += n;
+    if (i < s.size() && (s[i] == '.' || s[i] == '-' || s[i] == ' '))
+      ++i;
+    if (i >= s.size() ||
+        (s[i] != 'x' && s[i] != 'X' && s[i] != 'e' && s[i] != 'E'))
+      continue;
+    int second = 0;
+    if (digits(s, i + 1, 2, second) == 0)
+      continue;
+    season = first;
+    episode = second;
+    return start;
+  }
+  return npos;
+}
+
+/**
+ * Year marker: 4 digits, possibly after one of '.', '_', '-' or ' ' and an
+ * opening parenthesis, e.g. ".2001", " (2001)". Digits inside a longer
+ * number match as well, like the 1080 of 1080p.
+ * @return the position where the marker starts or npos.
+ */
+size_t findYear(std::string_view s, int& year) {
+  for (size_t start = 0; start < s.size(); ++start) {
+    size_t i = start;
+    if (s[i] == '.' || s[i] == '_' || s[i] == '-' || s[i] == ' ')
+      ++i;
+    if (i < s.size() && s[i] == '(')
+      ++i;
+    int value = 0;
+    if (digits(s, i, 4, value) == 4) {
+      year = value;
+      return start;
+    }
+  }
+  return npos;
+}
+
+/**
+ * Words of s: runs of letters and digits, lower cased.
+ */
+std::vector<std::string> words(std::string_view s) {
+  std::vector<std::string> out;
+  std::string word;
+  for (char c : s) {
+    if (std::isalnum(static_cast<unsigned char>(c))) {
+      word.push_back(
+          static_cast<char>(std::tolower(static_cast<unsigned char>(c))));
+    } else if (!word.empty()) {
+      out.push_back(std::move(word));
+      word.clear();
+    }
+  }
+  if (!word.empty())
+    out.push_back(std::move(word));
+  return out;
+}
+
+/**
+ * @return the value of s if it is made of 1 to max digits, -1 otherwise.
+ */
+int number(std::string_view s, size_t max) {
+  int value = -1;
+  if (s.empty() || s.size() > max || digits(s, 0, max, value) != s.size())
+    return -1;
+  return value;
+}
+
+int currentYear() {
+  static const int year = [] {
+    const std::time_t now =
+        std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    std::tm tm{};
+    ::localtime_r(&now, &tm);
+    return tm.tm_year + 1900;
+  }();
+  return year;
+}
 
 } // namespace
 
@@ -44,50 +158,48 @@ namespace TitleFinder {
 namespace Explorer {
 
 Discriminator::Discriminator()
-    : _season(-1), _episode(-1), _title(), _year(-1),
-      _reS(seasonDiscriminant_, std::regex::icase),
-      _reSE(episodeDiscriminant_, std::regex::icase), _reM(movieDiscriminant_) {
-}
+    : _season(-1), _episode(-1), _title(), _year(-1) {}
+
+Type Discriminator::getType(std::string_view path) {
+  std::string_view name(path);
+  const size_t slash = name.rfind('/');
+  if (slash != npos)
+    name.remove_prefix(slash + 1);
 
-Type Discriminator::getType(const std::filesystem::path& p) {
   _season = -1;
   _episode = -1;
   _title.clear();
   _year = -1;
 
-  std::string copy = p.filename().string();
-  std::smatch m;
   Type t = Type::None;
-  if (std::regex_search(copy, m, _reSE)) {
-    Logger()->debug("{} analyzed as Show", copy);
-    _season = std::stoi(m[1].str());
-    _episode = std::stoi(m[2].str());
-    _title = m.prefix().str();
-    if (std::regex_search(_title, m, _reM)) {
-      Logger()->debug("Found year {}", m[1].str());
-      _title = m.prefix().str();
-      _year = std::stoi(m[1].str());
+  size_t end = findEpisode(name, _season, _episode);
+  if (end != npos) {
+    Logger()->debug("{} analyzed as Show", name);
+    int year = -1;
+    const size_t found = findYear(name.substr(0, end), year);
+    if (found != npos) {
+      Logger()->debug("Found year {:04d}", year);
+      end = found;
+      _year = year;
     }
     t = Type::Show;
-  } else if (std::regex_search(copy, m, _reM)) {
-    Logger()->debug("{} analyzed as Movie with year {}", copy, m[1].str());
-    _title = m.prefix();
-    _year = std::stoi(m[1].str());
+  } else if ((end = findYear(name, _year)) != npos) {
+    Logger()->debug("{} analyzed as Movie with year {:04d}", name, _year);
     t = Type::Movie;
   } else {
-    Logger()->debug("{} analyzed as Movie without year", copy);
+    Logger()->debug("{} analyzed as Movie without year", name);
     t = Type::Movie;
-    _title = p.stem();
+    // Stem of the file name
+    end = name.rfind('.');
+    if (end == 0 || name == "..")
+      end = npos;
   }
-  auto now = std::chrono::system_clock::now();
-  auto tp = std::chrono::system_clock::to_time_t(now);
-  auto* tm = std::localtime(&tp);
-  auto currentYear = tm->tm_year + 1900;
-  if (_year > currentYear ) {
+  _title.assign(name.substr(0, end));
+
+  if (_year > currentYear()) {
     Logger()->debug("Year {} is in the futur, removing", _year);
     _year = -1;
-  }
-  else if (_year != -1 && _year < 1920) {
+  } else if (_year != -1 && _year < 1920) {
     Logger()->debug("Year {} is very old, removing", _year);
     _year = -1;
   }
@@ -95,6 +207,69 @@ Type Discriminator::getType(const std::filesystem::path& p) {
   return t;
 }
 
+void Discriminator::assumeShow(std::string_view title, int year, int season,
+                               int episode) {
+  _title.assign(title);
+  _year = year;
+  _season = season;
+  _episode = episode;
+}
+
+int folderSeason(std::string_view name) {
+  const auto w = words(name);
+  if (w.size() == 1 && w[0] == "specials")
+    return 0;
+  if (w.size() == 1 && w[0].size() > 1 && w[0][0] == 's')
+    return number(std::string_view(w[0]).substr(1), 2);
+  if (w.size() == 2 && (w[0] == "season" || w[0] == "saison" ||
+                        w[0] == "series" || w[0] == "staffel"))
+    return number(w[1], 2);
+  return -1;
+}
+
+bool findEpisodeNumber(std::string_view path, int& season, int& episode,
+                       bool seasonFolder) {
+  std::string_view name(path);
+  const size_t slash = name.rfind('/');
+  if (slash != npos)
+    name.remove_prefix(slash + 1);
+  const size_t dot = name.rfind('.');
+  if (dot != npos && dot != 0)
+    name = name.substr(0, dot);
+
+  // Full marker, possibly at the very beginning of the name
+  const std::string padded = " " + std::string(name);
+  int s = -1;
+  int e = -1;
+  if (findEpisode(padded, s, e) != npos) {
+    season = s;
+    episode = e;
+    return true;
+  }
+
+  const auto w = words(name);
+  for (size_t i = 0; i < w.size(); ++i) {
+    const std::string_view word(w[i]);
+    if (word == "e" || word == "ep" || word == "episode") {
+      if (i + 1 < w.size() && (e = number(w[i + 1], 3)) != -1)
+        break;
+    } else if (word[0] == 'e') {
+      const size_t start = word.compare(0, 2, "ep") == 0 ? 2 : 1;
+      if ((e = number(word.substr(start), 3)) != -1)
+        break;
+    }
+  }
+  // Otherwise a short number (not a year nor a resolution) leading the
+  // name, only in a season folder: elsewhere "300" is a movie
+  if (e == -1 && !w.empty() && seasonFolder)
+    e = number(w[0], 3);
+  if (e == -1)
+    return false;
+  season = -1;
+  episode = e;
+  return true;
+}
+
 } // namespace Explorer
 
 } // namespace TitleFinder
@@ -23,8 +23,8 @@
 
 #pragma once
 
-#include <filesystem>
-#include <regex>
+#include <string>
+#include <string_view>
 
 namespace TitleFinder {
 
@@ -32,6 +32,12 @@ enum class Type { Movie, Show, None };
 
 namespace Explorer {
 
+/**
+ * Split a release name in title, year, season and episode.
+ * The name is scanned once, without regular expressions, so a
+ * Discriminator is cheap to build and independent instances can be used
+ * from different threads.
+ */
 class Discriminator {
 
 public:
@@ -45,7 +51,10 @@ public:
    */
   virtual ~Discriminator() = default;
 
-  Type getType(const std::filesystem::path& p);
+  /**
+   * Analyze the file name of path (directories are ignored).
+   */
+  Type getType(std::string_view path);
 
   inline int getSeason() const { return _season; }
 
@@ -55,17 +64,37 @@ public:
 
   inline int getYear() const { return _year; }
 
+  /**
+   * Take the show, year and season given by the context of a file (its
+   * folders or its siblings) when its own name lacks them.
+   */
+  void assumeShow(std::string_view title, int year, int season, int episode);
+
 private:
   int _season;
   int _episode;
   std::string _title;
   int _year;
-
-  std::regex _reS;
-  std::regex _reSE;
-  std::regex _reM;
 };
 
+/**
+ * Season of a folder named like "Season 2", "Saison.02", "S02" or
+ * "Specials" (season 0).
+ * @return -1 if name is not a season folder.
+ */
+int folderSeason(std::string_view name);
+
+/**
+ * Episode of a file name holding little more than a number, like
+ * "E05.mkv", "Episode 5 - Title.mkv", "05.mkv" or "S02E05.mkv".
+ * A bare number leading the name, as in "05.mkv" or "05 - Title.mkv",
+ * only counts if seasonFolder.
+ * season is -1 if the name does not tell it.
+ * @return false if no episode number is found.
+ */
+bool findEpisodeNumber(std::string_view path, int& season, int& episode,
+                       bool seasonFolder = false);
+
 } // namespace Explorer
 
 } // namespace TitleFinder
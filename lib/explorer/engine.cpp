@@ -24,21 +24,29 @@
 #include "explorer/engine.hpp"
 
 #include <algorithm>
+#include <atomic>
 #include <cctype>
 #include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
 #include <exception>
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <map>
 #include <mutex>
 #include <nlohmann/json.hpp>
 #include <numeric>
+#include <optional>
 #include <regex>
 #include <stdexcept>
 #include <string_view>
 #include <thread>
+#include <tuple>
+#include <unordered_set>
 
 #include "api/authentication.hpp"
 #include "api/optionals.hpp"
@@ -47,9 +55,19 @@
 #include "api/tmdb.hpp"
 #include "api/tv.hpp"
 #include "api/tvseasons.hpp"
+#include "explorer/cache.hpp"
+#include "explorer/concurrencylimit.hpp"
+#include "explorer/deviceslots.hpp"
 #include "explorer/discriminator.hpp"
+#include "explorer/hash.hpp"
 #include "explorer/levenshtein.hpp"
 #include "explorer/logger.hpp"
+#include "explorer/mpmcqueue.hpp"
+#include "explorer/normalize.hpp"
+#include "explorer/pathfilter.hpp"
+#include "explorer/statbatch.hpp"
+#include "explorer/threadpool.hpp"
+#include "explorer/treewalker.hpp"
 #include "media/fileinfo.hpp"
 #include "media/muxer.hpp"
 #include "media/tags.hpp"
@@ -70,8 +88,6 @@
 using json = nlohmann::json;
 
 namespace {
-std::regex searchCleaner(R"([\._-]*)");
-
 bool mkdir(const std::filesystem::path& p) {
   TitleFinder::Explorer::Logger()->trace("mkir {}", p.string());
   if (!std::filesystem::exists(p)) {
@@ -86,35 +102,56 @@ constexpr std::string_view kTvSeasonsDir = "tvseasons";
 constexpr std::string_view kGenresDir = "genres";
 constexpr std::string_view kGenresTv = "tvlist.json";
 constexpr std::string_view kGenresMovie = "movielist.json";
+constexpr std::string_view kSearchKey = "search";
+constexpr std::chrono::hours kSearchMaxAge{24};
+constexpr std::string_view kNegativeDir = "negative";
+constexpr std::chrono::hours kNegativeMaxAge{12};
+constexpr std::string_view kManifest = "manifest.json";
+constexpr size_t kBatchSize = 256;
+constexpr size_t kStageCapacity = 64;
+constexpr size_t kMaxOpenFiles = 256;
+constexpr std::string_view kCatalog = "catalog.bin";
+// One edit allowed every kFuzzyLength characters in catalog lookups
+constexpr size_t kFuzzyLength = 5;
+constexpr unsigned kMaxFuzzyDistance = 3;
+constexpr double kGiB = 1024. * 1024. * 1024.;
 
-inline bool validCacheFile(const std::filesystem::path& p) {
-  if (!std::filesystem::exists(p)) {
-    return false;
-  }
-  auto now = std::chrono::system_clock::now().time_since_epoch();
-  auto write = std::filesystem::last_write_time(p).time_since_epoch();
-  return std::chrono::duration_cast<std::chrono::hours>(now - write) >
-         std::chrono::hours(24 * 6);
-}
+// Requests sent to TMDB by the current thread, to tell cache hits apart
+thread_local size_t tmdbRequests = 0;
+constexpr const char* kDefaultIncludes[] = {"*.mp4", "*.mkv", "*.avi"};
+// Hidden and NAS metadata folders, AppleDouble files, samples and extras
+constexpr const char* kDefaultExcludes[] = {
+    ".*/",         "@eaDir/",
+    "#recycle/",   "$RECYCLE.BIN/",
+    "lost+found/", "._*",
+    "[Ss]ample/",  "[Ss]amples/",
+    "[Ss]ample.*", "*[._ -][Ss]ample.*",
+    "[Ee]xtras/",  "[Ff]eaturettes/",
+    "[Tt]railers/"};
 
-std::pair<size_t, size_t> bestMatch(std::vector<std::string>& inputs,
-                                    const std::string& user) {
-  std::string copy;
-  copy.resize(user.size());
-  std::transform(user.cbegin(), user.cend(), copy.begin(),
-                 [](unsigned char c) { return std::tolower(c); });
+std::pair<size_t, size_t>
+closestName(const std::vector<TitleFinder::Explorer::Candidate>& list,
+            const std::string& user) {
+  const std::string copy = TitleFinder::Explorer::normalizeTitle(user);
+  std::vector<std::string> inputs(list.size());
+  std::transform(list.cbegin(), list.cend(), inputs.begin(),
+                 [](const TitleFinder::Explorer::Candidate& c) {
+                   return TitleFinder::Explorer::normalizeTitle(c.name);
+                 });
 
   size_t id = 0;
   size_t i = 0;
   unsigned value = static_cast<unsigned>(-1);
-  for (auto& input : inputs) {
-    std::transform(input.begin(), input.end(), input.begin(),
-                   [](unsigned char c) { return std::tolower(c); });
-
-    unsigned test = TitleFinder::Levenshtein(copy, input);
-    if (test < value) {
-      value = test;
-      id = i;
+  for (const auto& input : inputs) {
+    // The length difference is a lower bound of the distance
+    const size_t gap = input.size() > copy.size() ? input.size() - copy.size()
+                                                  : copy.size() - input.size();
+    if (gap < value) {
+      unsigned test = TitleFinder::Levenshtein(copy, input, value - 1);
+      if (test < value) {
+        value = test;
+        id = i;
+      }
     }
     ++i;
   }
@@ -122,6 +159,139 @@ std::pair<size_t, size_t> bestMatch(std::vector<std::string>& inputs,
   return std::make_pair(id, count);
 }
 
+int yearOf(const std::string& date) {
+  if (date.size() < 4 || date.compare(0, 4, "0000") == 0)
+    return -1;
+  return std::atoi(date.c_str());
+}
+
+std::filesystem::path
+negativeKey(TitleFinder::Type t, const std::string& title,
+            const TitleFinder::Explorer::Discriminator& d) {
+  const std::string query =
+      fmt::format("{}|{}|{}|{}|{}", static_cast<int>(t), title, d.getYear(),
+                  d.getSeason(), d.getEpisode());
+  return std::filesystem::path(kNegativeDir) /
+         fmt::format("{:016x}.json", TitleFinder::Explorer::fnv1a(query));
+}
+
+/**
+ * A file of predictBatch once discriminated.
+ */
+struct Analysis {
+  TitleFinder::Explorer::Discriminator discri{};
+  std::string title{};
+  TitleFinder::Type type = TitleFinder::Type::None;
+  bool exists = false;
+};
+
+/**
+ * Folder name as show title and year: "Show.Name (2008)" gives "show name"
+ * and 2008.
+ */
+std::pair<std::string, int> folderTitle(std::string_view folder) {
+  std::string title = TitleFinder::Explorer::normalizeTitle(folder);
+  int year = -1;
+  const size_t space = title.rfind(' ');
+  if (space != std::string::npos && title.size() - space == 5 &&
+      std::all_of(title.begin() + space + 1, title.end(),
+                  [](unsigned char c) { return std::isdigit(c); })) {
+    year = std::stoi(title.substr(space + 1));
+    title.resize(space);
+  }
+  return {title, year};
+}
+
+/**
+ * @return true if the words of title end with the words of suffix.
+ */
+bool endsWithWords(const std::string& title, const std::string& suffix) {
+  return title.size() > suffix.size() &&
+         title[title.size() - suffix.size() - 1] == ' ' &&
+         title.compare(title.size() - suffix.size(), suffix.size(), suffix) ==
+             0;
+}
+
+/**
+ * Resolve the show of every folder once and share it with the files whose
+ * name is not enough, like "Show/Season 02/E05.mkv" or
+ * "[group] Show.S02E05.mkv".
+ * The show is what most named episodes of the folder agree on, or else
+ * what the folder names tell.
+ */
+void shareFolderContext(const std::vector<std::filesystem::path>& files,
+                        std::vector<Analysis>& analyses) {
+  using namespace TitleFinder::Explorer;
+  using TitleFinder::Type;
+  using Key = std::tuple<std::string, int, int>;
+  std::map<std::filesystem::path, std::vector<size_t>> folders;
+  for (size_t i = 0; i < files.size(); ++i) {
+    if (analyses[i].exists)
+      folders[files[i].parent_path()].push_back(i);
+  }
+
+  for (const auto& [folder, members] : folders) {
+    std::map<Key, size_t> votes;
+    size_t named = 0;
+    for (size_t i : members) {
+      const auto& a = analyses[i];
+      if (a.type == Type::Show && !a.title.empty()) {
+        ++votes[{a.title, a.discri.getYear(), a.discri.getSeason()}];
+        ++named;
+      }
+    }
+    const auto best = std::max_element(
+        votes.begin(), votes.end(),
+        [](const auto& a, const auto& b) { return a.second < b.second; });
+    // Only a season folder makes a file named by a number an episode,
+    // siblings alone could be extras next to a movie like "Apollo 13"
+    const int inFolder = folderSeason(folder.filename().string());
+    std::optional<Key> context;
+    if (best != votes.end() && 2 * best->second > named) {
+      context = best->first;
+    } else {
+      const auto show = inFolder == -1 ? folder : folder.parent_path();
+      auto [title, year] = folderTitle(show.filename().string());
+      if (!title.empty())
+        context = Key{std::move(title), year, inFolder};
+    }
+    if (!context)
+      continue;
+
+    const auto& [title, year, season] = *context;
+    for (size_t i : members) {
+      auto& a = analyses[i];
+      if (a.type == Type::Show && !a.title.empty()) {
+        if (endsWithWords(a.title, title)) {
+          Logger()->debug("{} taken as {}", a.title, title);
+          a.discri.assumeShow(title,
+                              a.discri.getYear() == -1 ? year
+                                                       : a.discri.getYear(),
+                              a.discri.getSeason(), a.discri.getEpisode());
+          a.title = title;
+        }
+        continue;
+      }
+      if (a.type == Type::Movie && a.discri.getYear() != -1)
+        continue;
+      int s = -1;
+      int e = -1;
+      if (!findEpisodeNumber(files[i].filename().string(), s, e,
+                             inFolder != -1))
+        continue;
+      if (s == -1)
+        s = season;
+      if (s == -1)
+        continue;
+      Logger()->debug("{} taken as episode {} of {} season {}",
+                      files[i].string(), e, title, s);
+      a.discri.assumeShow(title, year, s, e);
+      a.title = title;
+      a.type = Type::Show;
+    }
+  }
+}
+
 } // namespace
 
 namespace TitleFinder {
@@ -130,8 +300,14 @@ namespace Explorer {
 
 Engine::Engine()
     : _tmdb{Api::Tmdb::create("")}, _language{}, _moviesGenres{},
-      _tvShowsGenres{}, _filter{nullptr}, _cacheDirectory(),
-      _spaceReplacement('.'), _useCache(true) {
+      _tvShowsGenres{}, _filter{nullptr}, _cache(), _manifest{nullptr},
+      _catalog{nullptr}, _tags(), _spaceReplacement('.'), _useCache(true),
+      _scorer(Scorer::Levenshtein), _listingJobs(1), _asynchronousStat(false),
+      _pathFilter() {
+  this->setIncludes({});
+  for (const char* pattern : kDefaultExcludes)
+    _pathFilter.exclude(pattern);
+
   char* test = nullptr;
   test = ::getenv("LC_MESSAGES");
   if (test == nullptr) {
@@ -152,12 +328,13 @@ Engine::Engine()
 #ifdef __linux__
   test = getenv("HOME");
   if (test) {
-    _cacheDirectory = std::filesystem::path(test) / ".cache/" TITLEFINDER_NAME;
-    if (!mkdir(_cacheDirectory)) {
-      Logger()->debug("creation of {} failed", _cacheDirectory.string());
-      _cacheDirectory.clear();
+    std::filesystem::path directory =
+        std::filesystem::path(test) / ".cache/" TITLEFINDER_NAME;
+    if (!mkdir(directory)) {
+      Logger()->debug("creation of {} failed", directory.string());
     } else {
-      Logger()->debug("Cache directory: {}", _cacheDirectory.string());
+      _cache.setDirectory(directory);
+      Logger()->debug("Cache directory: {}", directory.string());
     }
   }
 #endif
@@ -173,15 +350,15 @@ void Engine::setTmdbKey(const std::string& key) {
 }
 
 void Engine::loadGenresTv() {
-  const std::filesystem::path cache = _cacheDirectory / kGenresDir / kGenresTv;
-  if (_useCache && validCacheFile(cache)) {
-    Logger()->debug("Loading tv genres from {}", cache.string());
-    // load from cache
-    std::ifstream file(cache, std::ios::in);
-    if (file.is_open()) {
+  const std::filesystem::path cache =
+      std::filesystem::path(kGenresDir) / kGenresTv;
+  Cache::Lock lock;
+  if (_useCache) {
+    lock = _cache.lock(cache);
+    json j;
+    if (_cache.load(cache, j)) {
+      Logger()->debug("Loading tv genres from {}", cache.string());
       try {
-        json j = json::parse(file);
-        file.close();
         _tvShowsGenres.from_json(j);
         return;
       } catch (const std::exception& e) {
@@ -198,12 +375,7 @@ void Engine::loadGenresTv() {
     CAST_REPONSE(gr, Api::Genres::GenresList, sgenre);
     _tvShowsGenres = std::move(*sgenre);
     try {
-      mkdir(cache.parent_path());
-      std::ofstream file(cache, std::ios::out);
-      if (file.is_open()) {
-        file << _tvShowsGenres.json().dump();
-        file.close();
-      }
+      _cache.store(cache, _tvShowsGenres.json(), std::move(lock));
     } catch (const std::exception& e) {
       Logger()->warn("Unable to cache TV shows genres");
     }
@@ -214,15 +386,14 @@ void Engine::loadGenresTv() {
 
 void Engine::loadGenresMovie() {
   const std::filesystem::path cache =
-      _cacheDirectory / kGenresDir / kGenresMovie;
-  if (_useCache && validCacheFile(cache)) {
-    Logger()->debug("Loading movie genres from {}", cache.string());
-    // load from cache
-    std::ifstream file(cache, std::ios::in);
-    if (file.is_open()) {
+      std::filesystem::path(kGenresDir) / kGenresMovie;
+  Cache::Lock lock;
+  if (_useCache) {
+    lock = _cache.lock(cache);
+    json j;
+    if (_cache.load(cache, j)) {
+      Logger()->debug("Loading movie genres from {}", cache.string());
       try {
-        json j = json::parse(file);
-        file.close();
         _moviesGenres.from_json(j);
         return;
       } catch (const std::exception& e) {
@@ -239,12 +410,7 @@ void Engine::loadGenresMovie() {
     CAST_REPONSE(gr, Api::Genres::GenresList, mgenre);
     _moviesGenres = std::move(*mgenre);
     try {
-      mkdir(cache.parent_path());
-      std::ofstream file(cache, std::ios::out);
-      if (file.is_open()) {
-        file << _moviesGenres.json().dump();
-        file.close();
-      }
+      _cache.store(cache, _moviesGenres.json(), std::move(lock));
     } catch (const std::exception& e) {
       Logger()->warn("Unable to cache Movie genres");
     }
@@ -271,44 +437,75 @@ void Engine::setLanguage(const std::string& language) {
 }
 
 void Engine::setBlacklist(const std::string& blacklistPath) {
-  _filter = std::make_unique<NameFilter>(blacklistPath);
+  _filter = std::make_unique<NameFilter>(
+      blacklistPath, _cache.isValid() ? _cache.getDirectory()
+                                      : std::filesystem::path());
 }
 
 std::unique_ptr<Api::Search::SearchMovies>
 Engine::searchMovie(const std::string& searchString,
                     Api::optionalInt year) const {
+  const std::string cache =
+      fmt::format("{}/movie/{}/{}/{}", kSearchKey, _language.value_or(""),
+                  year.value_or(-1), searchString);
+  if (_useCache) {
+    json j;
+    if (_cache.loadShared(cache, j, kSearchMaxAge)) {
+      auto s = std::make_unique<Api::Search::SearchMovies>();
+      s->from_json(j);
+      return s;
+    }
+  }
   if (!_tmdb)
     throw std::runtime_error("You need to set an API key first");
   Api::Search search(_tmdb);
+  ++tmdbRequests;
   auto rep = search.searchMovies(_language, searchString, {}, {}, {}, year, {});
   CAST_REPONSE(rep, Api::Search::SearchMovies, s);
   (void)rep.release();
+  if (_useCache)
+    _cache.storeShared(cache, s->json());
   return std::unique_ptr<Api::Search::SearchMovies>(s);
 }
 
 std::unique_ptr<Api::Search::SearchTvShows>
 Engine::searchTvShow(const std::string& searchString,
                      Api::optionalInt year) const {
+  const std::string cache =
+      fmt::format("{}/tv/{}/{}/{}", kSearchKey, _language.value_or(""),
+                  year.value_or(-1), searchString);
+  if (_useCache) {
+    json j;
+    if (_cache.loadShared(cache, j, kSearchMaxAge)) {
+      auto s = std::make_unique<Api::Search::SearchTvShows>();
+      s->from_json(j);
+      return s;
+    }
+  }
   if (!_tmdb)
     throw std::runtime_error("You need to set an API key first");
   Api::Search search(_tmdb);
+  ++tmdbRequests;
   auto rep = search.searchTvShows(_language, {}, searchString, {}, year);
   CAST_REPONSE(rep, Api::Search::SearchTvShows, s);
   (void)rep.release();
+  if (_useCache)
+    _cache.storeShared(cache, s->json());
   return std::unique_ptr<Api::Search::SearchTvShows>(s);
 }
 
 std::unique_ptr<Api::Tv::Details> Engine::getTvShowDetails(int id) const {
   const std::filesystem::path cache =
-      _cacheDirectory / kTvDir / fmt::format("{}.json", id);
-  if (_useCache && validCacheFile(cache)) {
-    Logger()->debug("Loading TV show details from {}", cache.string());
-    // load from cache
-    std::ifstream file(cache, std::ios::in);
-    if (file.is_open()) {
+      std::filesystem::path(kTvDir) / fmt::format("{}.json", id);
+  Cache::Lock lock;
+  if (_useCache) {
+    // Hold the entry while fetching so concurrent workers wait for us
+    // instead of requesting the same show.
+    lock = _cache.lock(cache);
+    json j;
+    if (_cache.load(cache, j)) {
+      Logger()->debug("Loading TV show details from {}", cache.string());
       try {
-        json j = json::parse(file);
-        file.close();
         auto s = std::make_unique<Api::Tv::Details>();
         s->from_json(j);
         return s;
@@ -321,16 +518,12 @@ std::unique_ptr<Api::Tv::Details> Engine::getTvShowDetails(int id) const {
   if (!_tmdb)
     throw std::runtime_error("You need to set an API key first");
   Api::Tv show(_tmdb);
+  ++tmdbRequests;
   auto rep = show.getDetails(id, _language);
   CAST_REPONSE(rep, Api::Tv::Details, s);
   (void)rep.release();
   try {
-    mkdir(cache.parent_path());
-    std::ofstream file(cache, std::ios::out);
-    if (file.is_open()) {
-      file << s->json().dump();
-      file.close();
-    }
+    _cache.store(cache, s->json(), std::move(lock));
   } catch (const std::exception& e) {
     Logger()->warn("Unable to cache TV show details");
   }
@@ -340,38 +533,36 @@ std::unique_ptr<Api::Tv::Details> Engine::getTvShowDetails(int id) const {
 std::unique_ptr<Api::TvSeasons::Details>
 Engine::getSeasonDetails(int id, int season) const {
   const std::filesystem::path cache =
-      _cacheDirectory / kTvSeasonsDir / fmt::format("{}_{}.json", id, season);
+      std::filesystem::path(kTvSeasonsDir) /
+      fmt::format("{}_{}.json", id, season);
   std::unique_ptr<Api::TvSeasons::Details> s;
-  if (_useCache && validCacheFile(cache)) {
-    Logger()->debug("Loading TV season details from {}", cache.string());
-    // load from cache
-    std::ifstream file(cache, std::ios::in);
-    if (file.is_open()) {
+  Cache::Lock lock;
+  if (_useCache) {
+    lock = _cache.lock(cache);
+    json j;
+    if (_cache.load(cache, j)) {
+      Logger()->debug("Loading TV season details from {}", cache.string());
       try {
-        json j = json::parse(file);
-        file.close();
         s = std::make_unique<Api::TvSeasons::Details>();
         s->from_json(j);
       } catch (const std::exception& e) {
         Logger()->error("Failed to load TV season cache file with: {} ",
                         e.what());
+        s.reset();
       }
     }
-  } else {
+  }
+  if (!s) {
     if (!_tmdb)
       throw std::runtime_error("You need to set an API key first");
     Api::TvSeasons tvseasons(_tmdb);
+    ++tmdbRequests;
     auto rep = tvseasons.getDetails(id, season, _language);
     CAST_REPONSE(rep, Api::TvSeasons::Details, ss);
     s.reset(ss);
     (void)rep.release();
     try {
-      mkdir(cache.parent_path());
-      std::ofstream file(cache, std::ios::out);
-      if (file.is_open()) {
-        file << s->json().dump();
-        file.close();
-      }
+      _cache.store(cache, s->json(), std::move(lock));
     } catch (const std::exception& e) {
       Logger()->warn("Unable to cache TV season details");
     }
@@ -380,7 +571,21 @@ Engine::getSeasonDetails(int id, int season) const {
   return s;
 }
 
-const Engine::Prediction
+std::vector<std::string>
+Engine::learnTags(std::queue<std::filesystem::path> files, size_t minTitles) {
+  TagLearner learner(minTitles);
+  for (; !files.empty(); files.pop()) {
+    const std::string file = files.front().string();
+    learner.add(_filter ? _filter->filter(file) : file);
+  }
+  std::vector<std::string> tags = learner.tags();
+  _tags.clear();
+  _tags.insert(tags.begin(), tags.end());
+  Logger()->debug("{} release tags learned", tags.size());
+  return tags;
+}
+
+Engine::Prediction
 Engine::predictFile(std::string file, Media::FileInfo::Container container,
                     const std::filesystem::path& outputDirectory) const {
   if (!std::filesystem::exists(file))
@@ -392,235 +597,525 @@ Engine::predictFile(std::string file, Media::FileInfo::Container container,
   }
 
   std::string original_file{file};
-  if (_filter) {
-    file = _filter->filter(file);
-    Logger()->debug("File after filtering is {}", file);
+  Explorer::Discriminator discri;
+  auto t = Type::None;
+  const std::string title = this->analyze(file, discri, t);
+
+  std::string reason;
+  if (this->failedRecently(t, title, discri, reason)) {
+    Logger()->debug("Lookup of {} failed recently", original_file);
+    throw NoMatch(reason);
   }
 
-  Explorer::Discriminator discri;
-  auto t = discri.getType(file);
-  std::string title = discri.getTitle();
+  try {
+    if (t == Type::Movie) {
+      Prediction pred(Media::FileInfo{original_file});
+      this->predictMovie(pred, title, discri.getYear(), container,
+                         outputDirectory);
+      return pred;
+    } else if (t == Type::Show) {
+      Prediction pred(Media::FileInfo{original_file});
+      auto [show, withYear] = this->resolveTvShow(title, discri.getYear());
+      Logger()->debug("Looking for season {} and episode {}",
+                      discri.getSeason(), discri.getEpisode());
+      auto details = this->getSeasonDetails(show->id, discri.getSeason());
+      this->predictEpisode(pred, *show, withYear, *details,
+                           discri.getEpisode(), container, outputDirectory);
+      return pred;
+    } else {
+      Logger()->debug("Looking for a title tag (assuming movie)");
+      using namespace Media::Tag;
+      Prediction pred(Media::FileInfo{original_file});
+      std::string newTest(pred.input.getTag("title"_tagid).data());
+      if (newTest.empty())
+        throw NoMatch("Unable to predict file");
+      this->predictMovie(pred, newTest, discri.getYear(), container,
+                         outputDirectory, false);
+      return pred;
+    }
+  } catch (const NoMatch& e) {
+    // Only remember files TMDB has no answer for, not network failures
+    this->rememberFailure(t, title, discri, e.what());
+    throw;
+  }
+}
+
+void Engine::predictMovie(Prediction& pred, const std::string& title,
+                          int year, Media::FileInfo::Container container,
+                          const std::filesystem::path& outputDirectory,
+                          bool tryTag) const {
+  Logger()->debug("Searching for movie title {}", title);
+  Api::optionalInt searchYear;
+  if (year != -1)
+    searchYear = year;
+  auto rep = this->searchMovie(title, searchYear);
+  if (rep->total_results == 0) {
+    using namespace Media::Tag;
+    const std::string tag(pred.input.getTag("title"_tagid).data());
+    if (!tryTag || tag.empty()) {
+      if (tryTag)
+        Logger()->error("No tag title");
+      throw NoMatch("No match found");
+    }
+    Logger()->debug("Searching for movie now with title {}", tag);
+    this->predictMovie(pred, tag, year, container, outputDirectory, false);
+    return;
+  }
+  std::vector<Candidate> inputs(rep->results.size());
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    const auto& result = rep->results[i];
+    inputs[i] = {result.title, result.popularity, yearOf(result.release_date)};
+  }
+  const size_t selected = this->bestMatch(inputs, title, year).first;
+  pred.movie = std::make_unique<Api::MovieInfoCompact>(
+      std::move(rep->results[selected]));
+  Logger()->debug("Movie title found: {}", pred.movie->title);
+
+  pred.output = fmt::format("{}.({}){}", pred.movie->title,
+                            pred.movie->release_date.substr(0, 4),
+                            pred.input.getPath().extension().string());
+  std::replace(pred.output.begin(), pred.output.end(), ' ', _spaceReplacement);
+
+  pred.output = outputDirectory / pred.output;
+  switch (container) {
+  case Media::FileInfo::Container::Mkv:
+    pred.container = Media::FileInfo::Container::Mkv;
+    pred.output = (outputDirectory / pred.output).replace_extension(".mkv");
+    break;
+  case Media::FileInfo::Container::Mp4:
+    pred.container = Media::FileInfo::Container::Mp4;
+    pred.output = (outputDirectory / pred.output).replace_extension(".mp4");
+    break;
+  case Media::FileInfo::Container::Avi:
+    pred.container = Media::FileInfo::Container::Avi;
+    pred.output = (outputDirectory / pred.output).replace_extension(".avi");
+    break;
+  case Media::FileInfo::Container::None:
+    pred.container = Media::FileInfo::Container::None;
+    pred.output = (outputDirectory / pred.output).string();
+    break;
+  default:
+    pred.output = (outputDirectory / pred.output).string();
+    break;
+  }
+}
+
+std::string Engine::analyze(const std::string& file, Discriminator& discri,
+                            Type& t) const {
+  std::string filtered{file};
+  if (_filter) {
+    filtered = _filter->filter(file);
+    Logger()->debug("File after filtering is {}", filtered);
+  }
+  t = discri.getType(filtered);
+  std::string title = stripTags(normalizeTitle(discri.getTitle()), _tags);
   Logger()->debug("Discriminator found title {} and year {}", title,
                   discri.getYear());
-  std::replace(title.begin(), title.end(), '.', ' ');
-  std::regex_replace(title, searchCleaner, " ",
-                     std::regex_constants::match_any);
-
-  auto makeMovie = [this, &original_file, &discri, &outputDirectory, container](
-                       const std::string& title,
-                       Media::FileInfo* info = nullptr) -> Engine::Prediction {
-    Api::optionalInt year;
-    if (discri.getYear() != -1) {
-      year = discri.getYear();
-    }
-    auto rep = this->searchMovie(title, year);
-    size_t selected = 0;
+  return title;
+}
+
+bool Engine::failedRecently(Type t, const std::string& title,
+                            const Discriminator& discri,
+                            std::string& reason) const {
+  if (!_useCache)
+    return false;
+  json j;
+  if (!_cache.load(negativeKey(t, title, discri), j, kNegativeMaxAge))
+    return false;
+  reason = j.value("reason", "No match found");
+  return true;
+}
+
+void Engine::rememberFailure(Type t, const std::string& title,
+                             const Discriminator& discri,
+                             const std::string& reason) const {
+  if (!_useCache)
+    return;
+  const auto key = negativeKey(t, title, discri);
+  auto lock = _cache.lock(key);
+  try {
+    _cache.store(key,
+                 json{{"title", title},
+                      {"year", discri.getYear()},
+                      {"season", discri.getSeason()},
+                      {"episode", discri.getEpisode()},
+                      {"reason", reason}},
+                 std::move(lock));
+  } catch (const std::exception& e) {
+    Logger()->warn("Unable to remember the failure of {}: {}", title,
+                   e.what());
+  }
+}
+
+std::pair<std::unique_ptr<Api::TvShowInfoCompact>, bool>
+Engine::resolveTvShow(const std::string& title, int year) const {
+  auto show = this->findLocalTvShow(title, year);
+  if (show) {
+    Logger()->debug("TvShow title {} found in the catalog", title);
+    return {std::move(show), false};
+  }
+  Logger()->debug("Searching for tvshow title {}", title);
+  Api::optionalInt searchYear;
+  std::unique_ptr<Api::Search::SearchTvShows> rep;
+  size_t selected = 0;
+  for (auto i = 0; i < 2; ++i) {
     size_t count = 0;
+    rep = this->searchTvShow(title, searchYear);
     if (rep->total_results == 0)
-      throw std::logic_error("No match found");
-    else {
-      std::vector<std::string> inputs(rep->results.size());
-      for (size_t i = 0; i < inputs.size(); ++i) {
-        inputs[i] = rep->results[i].title;
-      }
-      std::tie(selected, count) = bestMatch(inputs, title);
-    }
-    Prediction pred(info == nullptr ? Media::FileInfo{original_file}
-                                    : std::move(*info));
-    Api::MovieInfoCompact* tmp =
-        new Api::MovieInfoCompact(std::move(rep->results[selected]));
-    pred.movie.reset(tmp);
-    Logger()->debug("Movie title found: {}", pred.movie->title);
-
-    pred.output = fmt::format("{}.({}){}", pred.movie->title,
-                              pred.movie->release_date.substr(0, 4),
-                              pred.input.getPath().extension().string());
-    std::replace(pred.output.begin(), pred.output.end(), ' ',
-                 _spaceReplacement);
-
-    pred.output = outputDirectory / pred.output;
-    switch (container) {
-    case Media::FileInfo::Container::Mkv:
-      pred.container = Media::FileInfo::Container::Mkv;
-      pred.output = (outputDirectory / pred.output).replace_extension(".mkv");
-      break;
-    case Media::FileInfo::Container::Mp4:
-      pred.container = Media::FileInfo::Container::Mp4;
-      pred.output = (outputDirectory / pred.output).replace_extension(".mp4");
-      break;
-    case Media::FileInfo::Container::Avi:
-      pred.container = Media::FileInfo::Container::Avi;
-      pred.output = (outputDirectory / pred.output).replace_extension(".avi");
-      break;
-    case Media::FileInfo::Container::None:
-      pred.container = Media::FileInfo::Container::None;
-      pred.output = (outputDirectory / pred.output).string();
-      break;
-    default:
-      pred.output = (outputDirectory / pred.output).string();
+      throw NoMatch("No match found");
+    std::vector<Candidate> inputs(rep->results.size());
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      const auto& result = rep->results[i];
+      inputs[i] = {result.name, result.popularity,
+                   yearOf(result.first_air_date)};
+    }
+    std::tie(selected, count) = this->bestMatch(inputs, title, year);
+
+    if (count == 1 || year == -1)
       break;
+    searchYear = year;
+    Logger()->debug("{} tvshow found with same title", count);
+    Logger()->debug("Using year {} to discrimitate", year);
+  }
+  show = std::make_unique<Api::TvShowInfoCompact>(
+      std::move(rep->results[selected]));
+  Logger()->debug("TvShow title found: {}", show->name);
+  return {std::move(show), searchYear.has_value()};
+}
+
+void Engine::predictEpisode(
+    Prediction& pred, const Api::TvShowInfoCompact& show, bool withYear,
+    const Api::TvSeasons::Details& season, int episode,
+    Media::FileInfo::Container container,
+    const std::filesystem::path& outputDirectory) const {
+  auto ep = std::find_if(season.episodes.begin(), season.episodes.end(),
+                         [episode](const Api::Episode& ep) {
+                           return ep.episode_number == episode;
+                         });
+  if (ep == season.episodes.end()) {
+    Logger()->debug("No episode found");
+    throw NoMatch("No episode found");
+  }
+  pred.tvshow = std::make_unique<Api::TvShowInfoCompact>(show);
+  pred.episode = std::make_unique<Api::Episode>(*ep);
+  std::replace(pred.episode->name.begin(), pred.episode->name.end(), '/', '-');
+  if (!withYear)
+    pred.output =
+        fmt::format("{0}/{0}.S{1:02d}/{0}.S{1:02d}E{2:02d}.{3}{4}", show.name,
+                    ep->season_number, ep->episode_number, pred.episode->name,
+                    pred.input.getPath().extension().string());
+  else
+    pred.output = fmt::format("{0}.{5:.4s}/{0}.{5:.4s}.S{1:02d}/"
+                              "{0}.{5:.4s}.S{1:02d}E{2:02d}.{3}{4}",
+                              show.name, ep->season_number, ep->episode_number,
+                              pred.episode->name,
+                              pred.input.getPath().extension().string(),
+                              show.first_air_date);
+  std::replace(pred.output.begin(), pred.output.end(), ' ', _spaceReplacement);
+
+  switch (container) {
+  case Media::FileInfo::Container::Mkv:
+    pred.container = Media::FileInfo::Container::Mkv;
+    pred.output = (outputDirectory / pred.output).replace_extension(".mkv");
+    break;
+  case Media::FileInfo::Container::Mp4:
+    pred.container = Media::FileInfo::Container::Mp4;
+    pred.output = (outputDirectory / pred.output).replace_extension(".mp4");
+    break;
+  case Media::FileInfo::Container::Avi:
+    pred.container = Media::FileInfo::Container::Avi;
+    pred.output = (outputDirectory / pred.output).replace_extension(".avi");
+    break;
+  case Media::FileInfo::Container::None:
+    pred.container = Media::FileInfo::Container::None;
+    pred.output = (outputDirectory / pred.output).string();
+    break;
+  default:
+    pred.output = (outputDirectory / pred.output).string();
+    break;
+  }
+}
+
+struct Engine::Unit {
+  Type type = Type::None;
+  std::vector<size_t> positions{}; ///< of the files in the planned list
+  std::vector<Analysis> analyses{};
+  std::vector<Outcome> outcomes{};
+  bool networkFailure = false; ///< a lookup failed without an answer
+};
+
+std::vector<std::unique_ptr<Engine::Unit>>
+Engine::plan(const std::vector<std::filesystem::path>& files,
+             const std::vector<FileStatus>& status,
+             std::vector<std::pair<size_t, Outcome>>& failed) const {
+  std::vector<Analysis> analyses(files.size());
+  for (size_t i = 0; i < files.size(); ++i) {
+    if (!status[i].valid) {
+      std::string error =
+          fmt::format("File {} does not exist.", files[i].string());
+      failed.emplace_back(i, Outcome{files[i], nullptr, std::move(error)});
+      continue;
     }
-    return pred;
-  };
+    auto& a = analyses[i];
+    a.title = this->analyze(files[i].string(), a.discri, a.type);
+    a.exists = true;
+  }
+  shareFolderContext(files, analyses);
 
-  if (t == Type::Movie) {
-    Logger()->debug("Searching for movie title {}", title);
+  std::vector<std::unique_ptr<Unit>> units;
+  std::map<std::tuple<std::string, int, int>, Unit*> shows;
+  for (size_t i = 0; i < files.size(); ++i) {
+    auto& a = analyses[i];
+    if (!a.exists)
+      continue;
+    std::string reason;
+    if (this->failedRecently(a.type, a.title, a.discri, reason)) {
+      Logger()->debug("Lookup of {} failed recently", files[i].string());
+      failed.emplace_back(i, Outcome{files[i], nullptr, std::move(reason)});
+      continue;
+    }
+    Unit* unit = nullptr;
+    if (a.type == Type::Show)
+      unit = shows[{a.title, a.discri.getYear(), a.discri.getSeason()}];
+    // Movies are unique, nothing to share
+    if (unit == nullptr) {
+      units.push_back(std::make_unique<Unit>());
+      unit = units.back().get();
+      unit->type = a.type;
+      if (a.type == Type::Show)
+        shows[{a.title, a.discri.getYear(), a.discri.getSeason()}] = unit;
+    }
+    unit->positions.push_back(i);
+    unit->analyses.push_back(std::move(a));
+    unit->outcomes.push_back(Outcome{files[i], nullptr, {}});
+  }
+  Logger()->debug("{} files to predict with {} lookups", files.size(),
+                  units.size());
+  return units;
+}
+
+void Engine::probe(Unit& unit) const {
+  for (auto& outcome : unit.outcomes) {
+    // The file may have been moved or deleted since it was listed
     try {
-      return makeMovie(title);
+      outcome.prediction =
+          std::make_unique<Prediction>(Media::FileInfo{outcome.file.string()});
     } catch (const std::exception& e) {
-      using namespace Media::Tag;
+      outcome.prediction.reset();
+      outcome.error = fmt::format("Unable to read {}: {}",
+                                  outcome.file.string(), e.what());
+    }
+  }
+}
+
+void Engine::lookup(Unit& unit, Media::FileInfo::Container container,
+                    const std::filesystem::path& outputDirectory) const {
+  auto fail = [this, &unit](size_t i, const std::exception& e) {
+    const auto& a = unit.analyses[i];
+    unit.outcomes[i].prediction.reset();
+    unit.outcomes[i].error = e.what();
+    // Only remember files TMDB has no answer for, not network failures
+    if (dynamic_cast<const NoMatch*>(&e) != nullptr)
+      this->rememberFailure(a.type, a.title, a.discri, e.what());
+    else
+      unit.networkFailure = true;
+  };
+
+  // Files probe could not read keep their error
+  auto probed = [&unit](size_t i) {
+    return unit.outcomes[i].prediction != nullptr;
+  };
+
+  if (unit.type != Type::Show) {
+    for (size_t i = 0; i < unit.outcomes.size(); ++i) {
+      if (!probed(i))
+        continue;
+      const auto& a = unit.analyses[i];
       try {
-        Media::FileInfo info{original_file};
-        std::string newTest(info.getTag("title"_tagid).data());
-        if (newTest.empty())
-          throw e;
-        Logger()->debug("Searching for movie now with title {}", newTest);
-        return makeMovie(newTest, &info);
+        this->predictMovie(*unit.outcomes[i].prediction, a.title,
+                           a.discri.getYear(), container, outputDirectory);
       } catch (const std::exception& e) {
-        Logger()->error("No tag title");
-        throw e;
+        fail(i, e);
       }
     }
-  } else if (t == Type::Show) {
-    Logger()->debug("Searching for tvshow title {}", title);
-    std::unique_ptr<Api::Search::SearchTvShows> rep;
-    Api::optionalInt year;
-    size_t selected = 0;
-    for (auto i = 0; i < 2; ++i) {
-      size_t count = 0;
-      rep = this->searchTvShow(title, year);
-      if (rep->total_results == 0)
-        throw std::logic_error("No match found");
-      else {
-        std::vector<std::string> inputs(rep->results.size());
-        for (size_t i = 0; i < inputs.size(); ++i) {
-          inputs[i] = rep->results[i].name;
-        }
-        std::tie(selected, count) = bestMatch(inputs, title);
+    return;
+  }
 
-        if (count == 1 || discri.getYear() == -1)
-          break;
-        year = discri.getYear();
-        Logger()->debug("{} tvshow found with same title", count);
-        Logger()->debug("Using year {} to discrimitate", year.value());
-      }
+  bool any = false;
+  for (size_t i = 0; i < unit.outcomes.size(); ++i)
+    any = any || probed(i);
+  if (!any)
+    return;
+
+  const auto& first = unit.analyses.front();
+  Logger()->debug("{} episodes of {} season {}", unit.outcomes.size(),
+                  first.title, first.discri.getSeason());
+  std::unique_ptr<Api::TvShowInfoCompact> show;
+  std::unique_ptr<Api::TvSeasons::Details> season;
+  bool withYear = false;
+  try {
+    std::tie(show, withYear) =
+        this->resolveTvShow(first.title, first.discri.getYear());
+    season = this->getSeasonDetails(show->id, first.discri.getSeason());
+  } catch (const std::exception& e) {
+    for (size_t i = 0; i < unit.outcomes.size(); ++i) {
+      if (probed(i))
+        fail(i, e);
     }
-    Prediction pred(Media::FileInfo{original_file});
-    Api::TvShowInfoCompact* tmp =
-        new Api::TvShowInfoCompact(std::move(rep->results[selected]));
-    pred.tvshow.reset(tmp);
-    Logger()->debug("TvShow title found: {}", pred.tvshow->name);
-    Api::TvSeasons season(_tmdb);
-    Logger()->debug("Looking for season {} and episode {}", discri.getSeason(),
-                    discri.getEpisode());
-    auto details = this->getSeasonDetails(pred.tvshow->id, discri.getSeason());
-
-    auto ep = std::find_if(details->episodes.begin(), details->episodes.end(),
-                           [discri](const Api::Episode& ep) {
-                             return ep.episode_number == discri.getEpisode();
-                           });
-    if (ep == details->episodes.end()) {
-      Logger()->debug("No episode found");
-      throw std::logic_error("No episode found");
-    }
-
-    std::replace(ep->name.begin(), ep->name.end(), '/', '-');
-    if (!year.has_value())
-      pred.output =
-          fmt::format("{0}/{0}.S{1:02d}/{0}.S{1:02d}E{2:02d}.{3}{4}",
-                      pred.tvshow->name, ep->season_number, ep->episode_number,
-                      ep->name, pred.input.getPath().extension().string());
-    else
-      pred.output =
-          fmt::format("{0}.{5:.4s}/{0}.{5:.4s}.S{1:02d}/"
-                      "{0}.{5:.4s}.S{1:02d}E{2:02d}.{3}{4}",
-                      pred.tvshow->name, ep->season_number, ep->episode_number,
-                      ep->name, pred.input.getPath().extension().string(),
-                      pred.tvshow->first_air_date);
-    std::replace(pred.output.begin(), pred.output.end(), ' ',
-                 _spaceReplacement);
-
-    switch (container) {
-    case Media::FileInfo::Container::Mkv:
-      pred.container = Media::FileInfo::Container::Mkv;
-      pred.output = (outputDirectory / pred.output).replace_extension(".mkv");
-      break;
-    case Media::FileInfo::Container::Mp4:
-      pred.container = Media::FileInfo::Container::Mp4;
-      pred.output = (outputDirectory / pred.output).replace_extension(".mp4");
-      break;
-    case Media::FileInfo::Container::Avi:
-      pred.container = Media::FileInfo::Container::Avi;
-      pred.output = (outputDirectory / pred.output).replace_extension(".avi");
-      break;
-    case Media::FileInfo::Container::None:
-      pred.container = Media::FileInfo::Container::None;
-      pred.output = (outputDirectory / pred.output).string();
-      break;
-    default:
-      pred.output = (outputDirectory / pred.output).string();
-      break;
+    return;
+  }
+  for (size_t i = 0; i < unit.outcomes.size(); ++i) {
+    if (!probed(i))
+      continue;
+    try {
+      this->predictEpisode(*unit.outcomes[i].prediction, *show, withYear,
+                           *season, unit.analyses[i].discri.getEpisode(),
+                           container, outputDirectory);
+    } catch (const std::exception& e) {
+      fail(i, e);
     }
+  }
+}
 
-    pred.episode = std::make_unique<Api::Episode>(std::move(*ep));
-    return pred;
-  } else {
-    Logger()->debug("Looking for a title tag (assuming movie)");
-    using namespace Media::Tag;
-    Media::FileInfo info{original_file};
-    std::string newTest(info.getTag("title"_tagid).data());
-    if (!newTest.empty())
-      return makeMovie(newTest, &info);
-    throw std::logic_error("Unable to predict file");
+std::vector<Engine::Outcome>
+Engine::predictBatch(const std::vector<std::filesystem::path>& files,
+                     Media::FileInfo::Container container,
+                     const std::filesystem::path& outputDirectory,
+                     int njobs) const {
+  if (!std::filesystem::is_directory(outputDirectory)) {
+    throw std::runtime_error(fmt::format(
+        "Output directory {} is not a directory", outputDirectory.string()));
   }
+  std::vector<Outcome> outcomes(files.size());
+  std::vector<std::pair<size_t, Outcome>> failed;
+  auto units =
+      this->plan(files, StatBatch(_asynchronousStat).stat(files), failed);
+  for (auto& [position, outcome] : failed)
+    outcomes[position] = std::move(outcome);
 
-  return makeMovie("Matrix");
+  ThreadPool pool(static_cast<size_t>(std::max(njobs, 1)));
+  for (auto& unit : units) {
+    pool.submit([this, &unit, container, &outputDirectory] {
+      this->probe(*unit);
+      this->lookup(*unit, container, outputDirectory);
+    });
+  }
+  pool.wait();
+
+  for (auto& unit : units) {
+    for (size_t i = 0; i < unit->positions.size(); ++i)
+      outcomes[unit->positions[i]] = std::move(unit->outcomes[i]);
+  }
+  return outcomes;
 }
 
 std::queue<std::filesystem::path>
 Engine::listFiles(const std::filesystem::path& directory,
                   bool recursive) const {
   std::queue<std::filesystem::path> queue;
+  this->walkFiles(directory, recursive, kBatchSize,
+                  [&queue](std::vector<std::filesystem::path>& batch,
+                           std::vector<FileStatus>&) {
+                    for (auto& file : batch)
+                      queue.push(std::move(file));
+                  });
+  return queue;
+}
+
+void Engine::walkFiles(const std::filesystem::path& directory, bool recursive,
+                       size_t batchSize, const FileConsumer& consumer,
+                       const TreeWalker::Prune& prune) const {
   if (!std::filesystem::is_directory(directory)) {
     Logger()->error("Input directory {} is not a directory",
                     directory.string());
-    return queue;
+    return;
   }
 
-  auto acceptFile = [](const std::filesystem::directory_entry& entry) -> bool {
-    if (!entry.is_regular_file())
+  std::atomic<size_t> unchanged{0};
+  // Rules see paths relative to directory, which prefixes every path walked
+  const size_t prefix = directory.native().size();
+  auto relative = [prefix](const std::filesystem::path& p) {
+    std::string_view r(p.native());
+    r.remove_prefix(std::min(prefix, r.size()));
+    while (!r.empty() && r.front() == '/')
+      r.remove_prefix(1);
+    return r;
+  };
+  auto selectFile = [this, &relative](const std::filesystem::path& file) {
+    return _pathFilter.selects(relative(file));
+  };
+  auto acceptFile = [this, &unchanged](const std::filesystem::path&,
+                                       const FileStatus& status) -> bool {
+    if (!status.valid || !status.regular)
       return false;
-    const std::string extension = entry.path().extension().string();
-    if (extension != ".mp4" && extension != ".mkv" && extension != ".avi")
+    if (_manifest && _manifest->isUnchanged(status)) {
+      ++unchanged;
       return false;
+    }
     return true;
   };
 
-  if (recursive) {
-    for (const auto& entry :
-         std::filesystem::recursive_directory_iterator{directory}) {
-      if (acceptFile(entry))
-        queue.push(entry);
-    }
-  } else {
-    for (const auto& entry : std::filesystem::directory_iterator{directory}) {
-      if (acceptFile(entry))
-        queue.push(entry);
-    }
+  // A batch is a folder (or a part of a large one)
+  TreeWalker walker(static_cast<size_t>(std::max(_listingJobs, 1)));
+  walker.setPrune([this, &relative, &prune](const std::filesystem::path& dir) {
+    return _pathFilter.prunes(relative(dir)) || (prune && prune(dir));
+  });
+  walker.setSelect(selectFile);
+  walker.useAsynchronousStat(_asynchronousStat);
+  const size_t folders =
+      walker.walk(directory, recursive, batchSize, acceptFile, consumer);
+  Logger()->debug("Listed {} folders in {}", folders, directory.string());
+  if (unchanged > 0)
+    Logger()->info("Skipping {} unchanged files", unchanged.load());
+}
+
+void Engine::setListingJobs(int jobs) { _listingJobs = jobs; }
+
+void Engine::setIncludes(const std::vector<std::string>& patterns) {
+  _pathFilter.clearIncludes();
+  if (patterns.empty()) {
+    for (const char* pattern : kDefaultIncludes)
+      _pathFilter.include(pattern);
+    return;
+  }
+  for (const auto& pattern : patterns)
+    _pathFilter.include(pattern);
+}
+
+void Engine::addExcludes(const std::vector<std::string>& patterns) {
+  for (const auto& pattern : patterns)
+    _pathFilter.exclude(pattern);
+}
+
+void Engine::useAsynchronousStat(bool asynchronous) {
+  _asynchronousStat = asynchronous;
+}
+
+Media::FileInfo::Container Engine::targetContainer(const Prediction& pred) {
+  if (pred.container == Media::FileInfo::Container::Other &&
+      pred.input.getPath() != std::filesystem::path(pred.output))
+    return pred.input.getContainer();
+  return pred.container;
+}
+
+bool Engine::transmuxes(const Prediction& pred) {
+  switch (targetContainer(pred)) {
+  case Media::FileInfo::Container::Mkv:
+  case Media::FileInfo::Container::Mp4:
+  case Media::FileInfo::Container::Avi:
+    return true;
+  default:
+    return false;
   }
-  return queue;
 }
 
 int Engine::apply(const Prediction& pred) const {
   using namespace Media::Tag;
 
   Media::Muxer* muxer = nullptr;
-  auto container = pred.container;
   if (pred.input.getPath() == std::filesystem::path(pred.output))
     Logger()->info("Not transmuxing, tags cannot be set.");
-  else if (container == Media::FileInfo::Container::Other) {
-    container = pred.input.getContainer();
-  }
+  const auto container = targetContainer(pred);
 
   switch (container) {
   case Media::FileInfo::Container::Mkv:
@@ -699,41 +1194,309 @@ int Engine::apply(const Prediction& pred) const {
       throw e;
     }
   }
+  if (_manifest)
+    _manifest->record(pred.output, pred.output, true);
   return 0;
 }
 
 void Engine::autoRename(std::queue<std::filesystem::path>& queue,
                         Media::FileInfo::Container container, int njobs,
                         const std::filesystem::path& outputDirectory) const {
-  std::mutex queue_mutex;
-  std::vector<std::thread> workers;
-  for (int i = 0; i < njobs; ++i) {
-    workers.push_back(std::thread([&] {
-      while (!queue.empty()) {
-        std::unique_lock lLock(queue_mutex);
-        auto file(std::move(queue.front()));
-        queue.pop();
-        lLock.unlock();
-        try {
-          auto pred =
-              this->predictFile(file.string(), container, outputDirectory);
-          Logger()->info("{} => {}", pred.input.getPath().string(),
-                         pred.output);
-          this->apply(pred);
-        } catch (const std::exception& e) {
-          Logger()->error("File {} failed with: {}", file.string(), e.what());
+  this->autoRename(queue, container, Workers{njobs, njobs, njobs},
+                   outputDirectory);
+}
+
+void Engine::autoRename(std::queue<std::filesystem::path>& queue,
+                        Media::FileInfo::Container container,
+                        const Workers& workers,
+                        const std::filesystem::path& outputDirectory) const {
+  this->pipeline(
+      [this, &queue](const FileConsumer& consumer) {
+        StatBatch batch(_asynchronousStat);
+        while (!queue.empty()) {
+          // Episodes of a season are grouped within a batch of sorted paths
+          std::vector<std::filesystem::path> files;
+          for (; !queue.empty() && files.size() < kBatchSize; queue.pop())
+            files.push_back(std::move(queue.front()));
+          std::sort(files.begin(), files.end());
+          auto status = batch.stat(files);
+          consumer(files, status);
         }
+      },
+      container, workers, outputDirectory);
+}
+
+void Engine::autoRename(const std::filesystem::path& directory,
+                        bool recursive, Media::FileInfo::Container container,
+                        const Workers& workers,
+                        const std::filesystem::path& outputDirectory) const {
+  this->pipeline(
+      [this, &directory, recursive,
+       &outputDirectory](const FileConsumer& consumer) {
+        // An output folder inside the tree only holds files already renamed
+        const auto root =
+            std::filesystem::absolute(directory).lexically_normal();
+        const auto output =
+            std::filesystem::absolute(outputDirectory).lexically_normal();
+        this->walkFiles(directory, recursive, kBatchSize, consumer,
+                        [&root, &output](const std::filesystem::path& folder) {
+                          return output != root &&
+                                 std::filesystem::absolute(folder)
+                                         .lexically_normal() == output;
+                        });
+      },
+      container, workers, outputDirectory);
+}
+
+void Engine::pipeline(
+    const std::function<void(const FileConsumer&)>& enumerate,
+    Media::FileInfo::Container container, const Workers& workers,
+    const std::filesystem::path& outputDirectory) const {
+  if (!std::filesystem::is_directory(outputDirectory)) {
+    throw std::runtime_error(fmt::format(
+        "Output directory {} is not a directory", outputDirectory.string()));
+  }
+
+  // enumerate -> probe -> lookup -> apply, each stage with its own threads
+  MpmcQueue<std::unique_ptr<Unit>> probing(kStageCapacity);
+  MpmcQueue<std::unique_ptr<Unit>> lookups(kStageCapacity);
+  MpmcQueue<Outcome> applying(kStageCapacity);
+  // Probed files stay open until applied
+  std::atomic<size_t> open{0};
+  // Outputs may land in the tree still being walked: never take them as input
+  std::unordered_set<std::string> produced;
+  std::mutex producedMutex;
+  auto key = [](const std::filesystem::path& p) {
+    return std::filesystem::absolute(p).lexically_normal().string();
+  };
+
+  // @return false if applying the prediction failed
+  auto finish = [this](Outcome& outcome) {
+    bool applied = true;
+    try {
+      if (!outcome.prediction)
+        throw std::logic_error(outcome.error);
+      const auto& pred = *outcome.prediction;
+      Logger()->info("{} => {}", pred.input.getPath().string(), pred.output);
+      this->apply(pred);
+    } catch (const std::exception& e) {
+      Logger()->error("File {} failed with: {}", outcome.file.string(),
+                      e.what());
+      if (_manifest)
+        _manifest->record(outcome.file, "", false);
+      applied = outcome.prediction == nullptr;
+    }
+    outcome.prediction.reset();
+    return applied;
+  };
+
+  // Stages start every thread they may need, their limits tell how many
+  // are actually busy
+  auto limit = [&workers](const char* name, int threads) {
+    threads = std::max(threads, 1);
+    const int minimum =
+        workers.adaptive ? std::clamp(workers.minimum, 1, threads) : threads;
+    return std::make_unique<ConcurrencyLimit>(name, minimum, threads,
+                                              minimum);
+  };
+  auto probeLimit = limit("Probe", workers.probe);
+  auto lookupLimit = limit("Lookup", workers.lookup);
+  auto applyLimit = limit("Apply", workers.apply);
+  using Clock = ConcurrencyLimit::Clock;
+
+  // A remux waits for a slot on its disks (one on a rotational disk)
+  // parked aside, while remuxes on other disks go on
+  DeviceSlots slots(std::max(workers.apply, 1));
+  std::deque<std::pair<DeviceSlots::Devices, Outcome>> parked;
+  // Apply workers sleep on wake until an outcome comes, the input is over
+  // or slots are released
+  std::mutex parkedMutex;
+  std::condition_variable wake;
+  // With parkedMutex held
+  auto unpark = [&](DeviceSlots::Devices& devices, Outcome& outcome) {
+    for (auto it = parked.begin(); it != parked.end(); ++it) {
+      if (slots.tryAcquire(it->first)) {
+        devices = it->first;
+        outcome = std::move(it->second);
+        parked.erase(it);
+        return true;
       }
-    }));
+    }
+    return false;
+  };
+  auto deliver = [&](Outcome&& outcome) {
+    applying.push(std::move(outcome));
+    std::lock_guard lock(parkedMutex);
+    wake.notify_one();
+  };
+
+  std::vector<std::thread> threads;
+  std::atomic<int> probers{std::max(workers.probe, 1)};
+  std::atomic<int> lookers{std::max(workers.lookup, 1)};
+  for (int i = probers.load(); i > 0; --i) {
+    threads.emplace_back([&] {
+      std::unique_ptr<Unit> unit;
+      while (probing.pop(unit)) {
+        // Reserve the files at once, so that probers cannot overshoot
+        const size_t count = unit->outcomes.size();
+        Backoff backoff;
+        size_t current = open.load();
+        for (;;) {
+          if (current > 0 && current + count > kMaxOpenFiles) {
+            backoff.pause();
+            current = open.load();
+          } else if (open.compare_exchange_weak(current, current + count)) {
+            break;
+          }
+        }
+        probeLimit->acquire();
+        const auto start = Clock::now();
+        this->probe(*unit);
+        probeLimit->release((Clock::now() - start) / std::max<size_t>(count, 1),
+                            false);
+        lookups.push(std::move(unit));
+      }
+      if (--probers == 0)
+        lookups.close();
+    });
   }
-  for (auto& t : workers) {
-    t.join();
+  for (int i = lookers.load(); i > 0; --i) {
+    threads.emplace_back([&] {
+      std::unique_ptr<Unit> unit;
+      while (lookups.pop(unit)) {
+        lookupLimit->acquire();
+        const auto start = Clock::now();
+        const size_t requests = tmdbRequests;
+        this->lookup(*unit, container, outputDirectory);
+        // Cache hits take microseconds, only round trips tell the load
+        if (tmdbRequests > requests || unit->networkFailure)
+          lookupLimit->release((Clock::now() - start) /
+                                   std::max<size_t>(tmdbRequests - requests, 1),
+                               unit->networkFailure);
+        else
+          lookupLimit->release();
+        for (auto& outcome : unit->outcomes) {
+          if (!outcome.prediction) {
+            --open;
+          } else {
+            std::lock_guard lock(producedMutex);
+            produced.insert(key(outcome.prediction->output));
+          }
+          deliver(std::move(outcome));
+        }
+      }
+      if (--lookers == 0) {
+        applying.close();
+        std::lock_guard lock(parkedMutex);
+        wake.notify_all();
+      }
+    });
   }
+  for (int i = std::max(workers.apply, 1); i > 0; --i) {
+    threads.emplace_back([&] {
+      Outcome outcome;
+      DeviceSlots::Devices devices;
+      for (;;) {
+        // Parked remuxes first: their disk may have been freed meanwhile
+        bool ready = false;
+        bool popped = false;
+        {
+          std::unique_lock lock(parkedMutex);
+          wake.wait(lock, [&] {
+            if ((ready = unpark(devices, outcome)))
+              return true;
+            const bool closed = applying.isClosed();
+            if ((popped = applying.tryPop(outcome)))
+              return true;
+            // Parked remuxes wait for the workers still holding slots
+            return closed && parked.empty();
+          });
+        }
+        if (!ready && !popped)
+          break;
+        bool slotted = ready;
+        if (popped) {
+          if (!outcome.prediction) {
+            finish(outcome);
+            continue;
+          }
+          // Plain renames do not load the disks, they never wait
+          if (transmuxes(*outcome.prediction)) {
+            devices =
+                DeviceSlots::devicesOf(outcome.prediction->input.getPath(),
+                                       outcome.prediction->output);
+            if (!slots.tryAcquire(devices)) {
+              std::lock_guard lock(parkedMutex);
+              parked.emplace_back(devices, std::move(outcome));
+              continue;
+            }
+            slotted = true;
+          }
+        }
+
+        // Renames take milliseconds, only remuxes (per GiB) tell the load
+        const bool remux = transmuxes(*outcome.prediction);
+        std::error_code error;
+        const auto size =
+            std::filesystem::file_size(outcome.prediction->input.getPath(),
+                                       error);
+        applyLimit->acquire();
+        const auto start = Clock::now();
+        const bool applied = finish(outcome);
+        if (remux && !error && size > 0)
+          applyLimit->release(
+              std::chrono::duration_cast<Clock::duration>(
+                  (Clock::now() - start) * (kGiB / static_cast<double>(size))),
+              !applied);
+        else if (!applied)
+          applyLimit->release(Clock::now() - start, true);
+        else
+          applyLimit->release();
+        --open;
+        if (slotted) {
+          slots.release(devices);
+          std::lock_guard lock(parkedMutex);
+          wake.notify_all();
+        }
+      }
+    });
+  }
+
+  // Pushes block while the probe queue is full, pausing the enumeration
+  try {
+    enumerate([&](std::vector<std::filesystem::path>& files,
+                  std::vector<FileStatus>& status) {
+      {
+        std::lock_guard lock(producedMutex);
+        size_t kept = 0;
+        for (size_t i = 0; i < files.size(); ++i) {
+          if (produced.count(key(files[i])) > 0)
+            continue;
+          files[kept] = std::move(files[i]);
+          status[kept++] = status[i];
+        }
+        files.resize(kept);
+        status.resize(kept);
+      }
+      std::vector<std::pair<size_t, Outcome>> failed;
+      for (auto& unit : this->plan(files, status, failed))
+        probing.push(std::move(unit));
+      for (auto& f : failed)
+        deliver(std::move(f.second));
+    });
+  } catch (const std::exception& e) {
+    Logger()->error("Listing files failed with: {}", e.what());
+  }
+  probing.close();
+  for (auto& t : threads)
+    t.join();
+  if (_manifest)
+    _manifest->save();
 }
 
 void Engine::setCacheDirectory(const std::filesystem::path& dir) {
   if (std::filesystem::is_directory(dir))
-    _cacheDirectory = dir;
+    _cache.setDirectory(dir);
   Logger()->debug("Cache directory is now {}", dir.string());
 }
 
@@ -742,6 +1505,122 @@ void Engine::useCache(bool cache) {
   _useCache = cache;
 }
 
+std::pair<size_t, size_t> Engine::bestMatch(const std::vector<Candidate>& list,
+                                            const std::string& title,
+                                            int year) const {
+  switch (_scorer) {
+  case Scorer::TokenSet:
+    return bestTokenMatch(list, title, year);
+  case Scorer::Levenshtein:
+  default:
+    return closestName(list, title);
+  }
+}
+
+void Engine::setScorer(Scorer scorer) { _scorer = scorer; }
+
+void Engine::useCatalog(bool catalog) {
+  _catalog.reset();
+  if (!catalog)
+    return;
+  if (!_cache.isValid()) {
+    Logger()->warn("No cache directory to look for the catalog");
+    return;
+  }
+  auto local = std::make_unique<Catalog>(_cache.getDirectory() / kCatalog);
+  if (!local->isOpen()) {
+    Logger()->warn("No usable catalog, run the catalog command first");
+    return;
+  }
+  _catalog = std::move(local);
+}
+
+size_t Engine::importCatalog(const std::filesystem::path& movies,
+                             const std::filesystem::path& tvshows) {
+  if (!_cache.isValid())
+    throw std::runtime_error("No cache directory to store the catalog");
+  std::vector<std::pair<Type, std::filesystem::path>> exports;
+  if (!movies.empty())
+    exports.emplace_back(Type::Movie, movies);
+  if (!tvshows.empty())
+    exports.emplace_back(Type::Show, tvshows);
+  const bool loaded = _catalog != nullptr;
+  // Unmap the current file before it is replaced
+  _catalog.reset();
+  const size_t count =
+      Catalog::import(exports, _cache.getDirectory() / kCatalog);
+  this->useCatalog(loaded);
+  return count;
+}
+
+std::unique_ptr<Api::TvShowInfoCompact>
+Engine::findLocalTvShow(const std::string& title, int year) const {
+  if (!_catalog)
+    return nullptr;
+  auto entries = _catalog->find(Type::Show, title);
+  const unsigned maxDistance = std::min<unsigned>(
+      kMaxFuzzyDistance, static_cast<unsigned>(title.size() / kFuzzyLength));
+  if (entries.empty() && maxDistance > 0) {
+    // Typos and abbreviations: keep the closest name if it is the only one
+    const auto matches = _catalog->search(Type::Show, title, maxDistance);
+    for (const auto& m : matches) {
+      if (m.distance != matches.front().distance)
+        break;
+      if (normalizeTitle(m.entry.name) !=
+          normalizeTitle(matches.front().entry.name)) {
+        Logger()->debug("Several catalog names close to {}", title);
+        return nullptr;
+      }
+      entries.push_back(m.entry);
+    }
+    if (!entries.empty())
+      Logger()->debug("Catalog name {} is {} edits away from {}",
+                      entries.front().name, matches.front().distance, title);
+  }
+  if (entries.empty())
+    return nullptr;
+  if (entries.size() > 1 && year != -1) {
+    Logger()->debug("{} tvshows named {} in the catalog", entries.size(),
+                    title);
+    return nullptr;
+  }
+  // Same choice as the online search without year: the most popular.
+  // The catalog only knows the original name: the (cached) details give
+  // the localized one, the first air date and the genres.
+  const int id = static_cast<int>(entries.front().id);
+  std::unique_ptr<Api::Tv::Details> details;
+  try {
+    details = this->getTvShowDetails(id);
+  } catch (const std::exception& e) {
+    Logger()->debug("No details for catalog tvshow {}: {}", id, e.what());
+    return nullptr;
+  }
+  auto show = std::make_unique<Api::TvShowInfoCompact>(
+      static_cast<const Api::TvShowInfoCompact&>(*details));
+  show->genre_ids.clear();
+  for (const auto& genre : details->genres)
+    show->genre_ids.push_back(genre.first);
+  return show;
+}
+
+void Engine::useManifest(bool manifest, bool prune) {
+  if (!manifest) {
+    _manifest.reset();
+    return;
+  }
+  if (!_cache.isValid()) {
+    Logger()->warn("No cache directory to store the manifest");
+    return;
+  }
+  _manifest = std::make_unique<Manifest>(_cache.getDirectory() / kManifest);
+  _manifest->setPruning(prune);
+}
+
+void Engine::useSharedCache(bool shared) {
+  Logger()->debug("Shared cache is {}", shared ? "enabled" : "disabled");
+  _cache.useSharedMemory(shared);
+}
+
 } // namespace Explorer
 
 } // namespace TitleFinder
@@ -25,9 +25,13 @@
 
 #include <cmath>
 #include <filesystem>
+#include <functional>
 #include <memory>
 #include <queue>
+#include <stdexcept>
 #include <string>
+#include <unordered_set>
+#include <vector>
 
 #include "api/genres.hpp"
 #include "api/optionals.hpp"
@@ -36,8 +40,16 @@
 #include "api/tmdb.hpp"
 #include "api/tv.hpp"
 #include "api/tvseasons.hpp"
+#include "explorer/cache.hpp"
+#include "explorer/catalog.hpp"
+#include "explorer/concurrencylimit.hpp"
 #include "explorer/discriminator.hpp"
+#include "explorer/manifest.hpp"
 #include "explorer/namefilter.hpp"
+#include "explorer/pathfilter.hpp"
+#include "explorer/similarity.hpp"
+#include "explorer/taglearner.hpp"
+#include "explorer/treewalker.hpp"
 #include "media/fileinfo.hpp"
 #include "media/muxer.hpp"
 
@@ -61,6 +73,30 @@ public:
           container(Media::FileInfo::Container::Other) {}
   };
 
+  /**
+   * TMDB has no answer for a file: worth remembering, unlike a network
+   * failure.
+   */
+  struct NoMatch : std::logic_error {
+    using std::logic_error::logic_error;
+  };
+
+  /**
+   * What predictBatch found for one file: a prediction or why it failed.
+   */
+  struct Outcome {
+    std::filesystem::path file{};
+    std::unique_ptr<Prediction> prediction{};
+    std::string error{};
+  };
+
+  /**
+   * How search results are compared to the title found in the file name.
+   * Levenshtein: edit distance between the names only.
+   * TokenSet: word based similarity, then popularity and year.
+   */
+  enum class Scorer { Levenshtein, TokenSet };
+
   /**
    * Empty constructor
    */
@@ -94,32 +130,269 @@ public:
   std::unique_ptr<Api::TvSeasons::Details> getSeasonDetails(int id,
                                                             int season) const;
 
-  const Prediction
+  Prediction
   predictFile(std::string file, Media::FileInfo::Container container,
               const std::filesystem::path& outputDirectory) const;
 
+  /**
+   * Predict all files at once: the episodes of a same season (same title,
+   * year and season) share a single show lookup and season fetch.
+   * Lookups run on a pool of njobs threads.
+   * @return one outcome per file, in the same order.
+   */
+  std::vector<Outcome>
+  predictBatch(const std::vector<std::filesystem::path>& files,
+               Media::FileInfo::Container container,
+               const std::filesystem::path& outputDirectory,
+               int njobs = 1) const;
+
   std::queue<std::filesystem::path>
   listFiles(const std::filesystem::path& directory, bool recursive) const;
 
+  using FileConsumer = TreeWalker::Consumer;
+
+  /**
+   * Walk directory and hand the files listFiles would return to consumer
+   * as soon as they are found, by sorted batches of one folder (or of at
+   * most batchSize files), with their status. The walk waits while
+   * consumer is busy.
+   * Folders are listed in parallel (see setListingJobs), in no particular
+   * order; those matching prune are skipped with their content.
+   */
+  void walkFiles(const std::filesystem::path& directory, bool recursive,
+                 size_t batchSize, const FileConsumer& consumer,
+                 const TreeWalker::Prune& prune = nullptr) const;
+
+  /**
+   * Number of folders listed at the same time by walkFiles, worth raising
+   * on network file systems.
+   */
+  void setListingJobs(int jobs);
+
+  /**
+   * Patterns of the files walkFiles keeps (see PathFilter), in place of the
+   * default video extensions. An empty list restores them.
+   * @throw std::invalid_argument for an invalid pattern.
+   */
+  void setIncludes(const std::vector<std::string>& patterns);
+
+  /**
+   * Patterns of the files and folders walkFiles skips, in addition to
+   * hidden and NAS metadata folders, samples and extras.
+   * @throw std::invalid_argument for an invalid pattern.
+   */
+  void addExcludes(const std::vector<std::string>& patterns);
+
+  /**
+   * Batch the stat calls of listing and planning through io_uring where
+   * available, to overlap their latency on network file systems.
+   */
+  void useAsynchronousStat(bool asynchronous);
+
   int apply(const Prediction& pred) const;
 
+  /**
+   * Container apply writes pred to (None or Other for a plain rename).
+   */
+  static Media::FileInfo::Container targetContainer(const Prediction& pred);
+
+  /**
+   * @return true if apply remuxes pred rather than renaming it.
+   */
+  static bool transmuxes(const Prediction& pred);
+
+  /**
+   * Threads of each stage of autoRename: probing files (libav), looking
+   * them up (network) and applying predictions (disk).
+   * If adaptive, these are upper bounds: each stage starts with minimum
+   * threads and adjusts from its throughput, latency and errors (see
+   * ConcurrencyLimit).
+   */
+  struct Workers {
+    int probe;
+    int lookup;
+    int apply;
+    bool adaptive = false;
+    int minimum = 1;
+  };
+
   void autoRename(std::queue<std::filesystem::path>& queue,
                   Media::FileInfo::Container container, int njobs,
                   const std::filesystem::path& outputDirectory) const;
 
+  /**
+   * Predict and apply the files of queue through a pipeline: the files are
+   * grouped, probed, looked up and applied by distinct threads connected by
+   * bounded queues, so that many lookups can wait on the network while a
+   * couple of remuxes share the disk.
+   */
+  void autoRename(std::queue<std::filesystem::path>& queue,
+                  Media::FileInfo::Container container,
+                  const Workers& workers,
+                  const std::filesystem::path& outputDirectory) const;
+
+  /**
+   * Same pipeline fed by walking directory: the first files are processed
+   * while the rest of the tree is still being listed.
+   */
+  void autoRename(const std::filesystem::path& directory, bool recursive,
+                  Media::FileInfo::Container container,
+                  const Workers& workers,
+                  const std::filesystem::path& outputDirectory) const;
+
   void setCacheDirectory(const std::filesystem::path& dir);
 
   void useCache(bool cache);
 
+  /**
+   * Share shows, seasons and search results with other running processes
+   * through a shared memory segment.
+   */
+  void useSharedCache(bool shared);
+
+  /**
+   * Remember processed files in the cache directory and skip them in
+   * listFiles as long as they do not change.
+   * If prune, the files remembered are all checked when the manifest is
+   * saved, to forget those deleted since.
+   */
+  void useManifest(bool manifest, bool prune = false);
+
+  void setScorer(Scorer scorer);
+
+  /**
+   * Resolve tv shows against the catalog stored in the cache directory
+   * before searching online.
+   */
+  void useCatalog(bool catalog);
+
+  /**
+   * Replace the catalog of the cache directory with the content of TMDB
+   * daily exports. Either path may be empty.
+   * @return the number of titles imported.
+   */
+  size_t importCatalog(const std::filesystem::path& movies,
+                       const std::filesystem::path& tvshows);
+
+  /**
+   * Learn the release tags repeated over files (after blacklist filtering)
+   * and strip them from the titles searched from now on.
+   * @return the tags learned.
+   */
+  std::vector<std::string> learnTags(std::queue<std::filesystem::path> files,
+                                     size_t minTitles = 3);
+
 private:
+  /**
+   * Run the autoRename pipeline over the batches given by enumerate.
+   */
+  void pipeline(const std::function<void(const FileConsumer&)>& enumerate,
+                Media::FileInfo::Container container, const Workers& workers,
+                const std::filesystem::path& outputDirectory) const;
+
+  /**
+   * Unit of lookup: a movie or the episodes of a season.
+   */
+  struct Unit;
+
+  /**
+   * Discriminate files and group them in units.
+   * Files which cannot be looked up are added to failed with their
+   * position.
+   */
+  std::vector<std::unique_ptr<Unit>>
+  plan(const std::vector<std::filesystem::path>& files,
+       const std::vector<FileStatus>& status,
+       std::vector<std::pair<size_t, Outcome>>& failed) const;
+
+  /**
+   * Open the files of unit, their predictions start here.
+   * A file that cannot be opened gets an error and no prediction, lookup
+   * skips it.
+   */
+  void probe(Unit& unit) const;
+
+  /**
+   * Search unit and complete its predictions.
+   */
+  void lookup(Unit& unit, Media::FileInfo::Container container,
+              const std::filesystem::path& outputDirectory) const;
+
+  /**
+   * Search the movie title and fill pred. Unless tryTag is false, the
+   * title tag of the file is searched if title finds nothing.
+   */
+  void predictMovie(Prediction& pred, const std::string& title, int year,
+                    Media::FileInfo::Container container,
+                    const std::filesystem::path& outputDirectory,
+                    bool tryTag = true) const;
+
+  /**
+   * Filter and discriminate file.
+   * @return the title to search.
+   */
+  std::string analyze(const std::string& file, Discriminator& discri,
+                      Type& t) const;
+
+  /**
+   * @return true (and why in reason) if the same lookup failed recently.
+   */
+  bool failedRecently(Type t, const std::string& title,
+                      const Discriminator& discri, std::string& reason) const;
+
+  /**
+   * Cache reason as the answer to the lookup, if the cache is used.
+   */
+  void rememberFailure(Type t, const std::string& title,
+                       const Discriminator& discri,
+                       const std::string& reason) const;
+
+  /**
+   * Find the tv show named title, in the catalog or online.
+   * @return the show and whether year was needed to pick it.
+   */
+  std::pair<std::unique_ptr<Api::TvShowInfoCompact>, bool>
+  resolveTvShow(const std::string& title, int year) const;
+
+  /**
+   * Fill pred with episode of show, looked up in season.
+   */
+  void predictEpisode(Prediction& pred, const Api::TvShowInfoCompact& show,
+                      bool withYear, const Api::TvSeasons::Details& season,
+                      int episode, Media::FileInfo::Container container,
+                      const std::filesystem::path& outputDirectory) const;
+
+  /**
+   * Look title up in the catalog, then get the details of the match.
+   * @return nullptr if there is no catalog, no match, several matches
+   * that only a year could tell apart, or no details for the match.
+   */
+  std::unique_ptr<Api::TvShowInfoCompact>
+  findLocalTvShow(const std::string& title, int year) const;
+
+  /**
+   * @return the index of the best candidate and the number of candidates
+   * with the same name.
+   */
+  std::pair<size_t, size_t> bestMatch(const std::vector<Candidate>& list,
+                                      const std::string& title,
+                                      int year) const;
+
   std::shared_ptr<Api::Tmdb> _tmdb;
   Api::optionalString _language;
   Api::Genres::GenresList _moviesGenres;
   Api::Genres::GenresList _tvShowsGenres;
   std::unique_ptr<NameFilter> _filter;
-  std::filesystem::path _cacheDirectory;
+  Cache _cache;
+  std::unique_ptr<Manifest> _manifest;
+  std::unique_ptr<Catalog> _catalog;
+  std::unordered_set<std::string> _tags;
   char _spaceReplacement;
   bool _useCache;
+  Scorer _scorer;
+  int _listingJobs;
+  bool _asynchronousStat;
+  PathFilter _pathFilter;
 };
 
 } // namespace Explorer
@@ -1,7 +1,7 @@
 /**
  * @file explorer/levenshtein.cpp
  *
- * @brief Implementation of the 2 matrix rows Levensthein algorithm
+ * @brief Bit-parallel Levenshtein distance (Myers/Hyyro)
  *
  * @author Jordan Bieder
  *
@@ -24,32 +24,116 @@
 #include "explorer/levenshtein.hpp"
 
 #include <algorithm>
-#include <functional>
-#include <iostream>
-#include <numeric>
+#include <array>
+#include <cstdint>
+#include <limits>
 #include <string>
 #include <vector>
 
+namespace {
+
+constexpr size_t kWord = 64;
+// Patterns up to kStackBlocks * 64 characters never touch the heap
+constexpr size_t kStackBlocks = 4;
+constexpr uint64_t kHigh = uint64_t(1) << (kWord - 1);
+
+/**
+ * Advance one 64 rows block of the DP matrix by one column.
+ * @param pv Positive vertical deltas
+ * @param mv Negative vertical deltas
+ * @param eq Rows matching the current text character
+ * @param hin Horizontal delta entering the block from above
+ * @param last Row whose horizontal delta is returned
+ * @return Horizontal delta at row last
+ */
+inline int advanceBlock(uint64_t& pv, uint64_t& mv, uint64_t eq, int hin,
+                        uint64_t last) {
+  const uint64_t xv = eq | mv;
+  if (hin < 0)
+    eq |= 1;
+  const uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+  uint64_t ph = mv | ~(xh | pv);
+  uint64_t mh = pv & xh;
+  const int hout = (ph & last) ? 1 : ((mh & last) ? -1 : 0);
+  ph <<= 1;
+  mh <<= 1;
+  if (hin < 0)
+    mh |= 1;
+  else if (hin > 0)
+    ph |= 1;
+  pv = mh | ~(xv | ph);
+  mv = ph & xv;
+  return hout;
+}
+
+/**
+ * Hyyro's formulation of Myers' algorithm, pattern split in 64 rows blocks.
+ * peq holds blocks words per character, pv and mv one word per block.
+ * Each column changes the last row by at most one, so the computation stops
+ * once the score cannot come back under maxDistance.
+ */
+unsigned blocked(const std::string& pattern, const std::string& text,
+                 uint64_t* peq, uint64_t* pv, uint64_t* mv, size_t blocks,
+                 unsigned maxDistance) {
+  const size_t m = pattern.size();
+  std::fill_n(peq, 256 * blocks, 0);
+  for (size_t i = 0; i < m; ++i) {
+    const auto c = static_cast<unsigned char>(pattern[i]);
+    peq[c * blocks + i / kWord] |= uint64_t(1) << (i % kWord);
+  }
+  for (size_t b = 0; b < blocks; ++b) {
+    pv[b] = ~uint64_t(0);
+    mv[b] = 0;
+  }
+  const uint64_t last = uint64_t(1) << ((m - 1) % kWord);
+  unsigned score = static_cast<unsigned>(m);
+  uint64_t remaining = text.size();
+  for (unsigned char c : text) {
+    const uint64_t* eq = peq + c * blocks;
+    // First row of the matrix grows by one at each column
+    int carry = 1;
+    for (size_t b = 0; b + 1 < blocks; ++b)
+      carry = advanceBlock(pv[b], mv[b], eq[b], carry, kHigh);
+    score += advanceBlock(pv[blocks - 1], mv[blocks - 1], eq[blocks - 1],
+                          carry, last);
+    if (score > maxDistance + --remaining)
+      return maxDistance + 1;
+  }
+  return score;
+}
+
+} // namespace
+
 namespace TitleFinder {
 
 unsigned Levenshtein(const std::string& s, const std::string& t) {
-  std::vector<unsigned> v(t.size() + 1, 0);
-  std::vector<unsigned> w(t.size() + 1, 0);
-
-  std::iota(v.begin(), v.end(), 0);
-  for (unsigned i = 0; i < s.size(); ++i) {
-    w[0] = i + 1;
+  return Levenshtein(s, t, std::numeric_limits<unsigned>::max() - 1);
+}
 
-    for (unsigned j = 0; j < t.size(); ++j) {
-      unsigned deletionCost = v[j + 1] + 1;
-      unsigned insertionCost = w[j] + 1;
-      unsigned substitutionCost = s[i] == t[j] ? v[j] : v[j] + 1;
-      w[j + 1] = std::min({deletionCost, insertionCost, substitutionCost});
-    }
+unsigned Levenshtein(const std::string& s, const std::string& t,
+                     unsigned maxDistance) {
+  // The distance is symmetric: use the shortest string as pattern
+  const std::string& pattern = s.size() <= t.size() ? s : t;
+  const std::string& text = s.size() <= t.size() ? t : s;
+  // At least one edit per extra character
+  if (text.size() - pattern.size() > maxDistance)
+    return maxDistance + 1;
+  if (pattern.empty())
+    return static_cast<unsigned>(text.size());
 
-    std::swap(v, w);
+  const size_t blocks = (pattern.size() + kWord - 1) / kWord;
+  if (blocks <= kStackBlocks) {
+    std::array<uint64_t, 256 * kStackBlocks> peq;
+    std::array<uint64_t, kStackBlocks> pv;
+    std::array<uint64_t, kStackBlocks> mv;
+    return blocked(pattern, text, peq.data(), pv.data(), mv.data(), blocks,
+                   maxDistance);
   }
-  return v.back();
+  std::vector<uint64_t> peq(256 * blocks);
+  std::vector<uint64_t> pv(blocks);
+  std::vector<uint64_t> mv(blocks);
+  return blocked(pattern, text, peq.data(), pv.data(), mv.data(), blocks,
+                 maxDistance);
 }
 
 } // namespace TitleFinder
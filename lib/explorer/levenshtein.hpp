@@ -29,4 +29,11 @@ namespace TitleFinder {
 
 unsigned Levenshtein(const std::string& s, const std::string& t);
 
+/**
+ * Bounded distance: stops as soon as the distance is known to exceed
+ * maxDistance and returns maxDistance + 1 in that case.
+ */
+unsigned Levenshtein(const std::string& s, const std::string& t,
+                     unsigned maxDistance);
+
 }
@@ -0,0 +1,187 @@
+/**
+ * @file explorer/manifest.cpp
+ *
+ * @brief Persistent record of already processed files
+ *
+ * @author Jordan Bieder
+ *
+ * @copyright Copyright (C) 2023 Jordan Bieder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "explorer/manifest.hpp"
+
+#include <fstream>
+#include <nlohmann/json.hpp>
+#include <sys/stat.h>
+
+#include "explorer/cache.hpp"
+#include "explorer/logger.hpp"
+
+using json = nlohmann::json;
+
+namespace {
+
+constexpr int kVersion = 1;
+
+struct Identity {
+  uint64_t device;
+  uint64_t inode;
+  uint64_t size;
+  int64_t mtime;
+};
+
+bool identify(const std::filesystem::path& p, Identity& id) {
+  struct stat st;
+  if (::stat(p.c_str(), &st) != 0)
+    return false;
+  id.device = static_cast<uint64_t>(st.st_dev);
+  id.inode = static_cast<uint64_t>(st.st_ino);
+  id.size = static_cast<uint64_t>(st.st_size);
+  id.mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 +
+             st.st_mtim.tv_nsec;
+  return true;
+}
+
+} // namespace
+
+namespace TitleFinder {
+
+namespace Explorer {
+
+Manifest::Manifest(const std::filesystem::path& file)
+    : _file(file), _entries(read(file)), _recorded(), _mutex(),
+      _modified(false), _prune(false) {
+  Logger()->debug("Manifest {} lists {} files", _file.string(),
+                  _entries.size());
+}
+
+std::map<Manifest::Key, Manifest::Entry>
+Manifest::read(const std::filesystem::path& file) {
+  std::map<Key, Entry> entries;
+  std::ifstream input(file, std::ios::in);
+  if (!input.is_open()) {
+    Logger()->debug("No manifest found in {}", file.string());
+    return entries;
+  }
+  try {
+    json j = json::parse(input);
+    if (j.value("version", 0) != kVersion) {
+      Logger()->info("Ignoring manifest {} from another version",
+                     file.string());
+      return entries;
+    }
+    for (const auto& f : j["files"]) {
+      Key key{f["device"].get<uint64_t>(), f["inode"].get<uint64_t>()};
+      entries[key] =
+          Entry{f["size"].get<uint64_t>(), f["mtime"].get<int64_t>(),
+                f.value("input", ""), f.value("output", ""),
+                f.value("success", false)};
+    }
+  } catch (const std::exception& e) {
+    Logger()->error("Failed to load manifest {} with: {}", file.string(),
+                    e.what());
+    entries.clear();
+  }
+  return entries;
+}
+
+Manifest::~Manifest() {
+  try {
+    this->save();
+  } catch (const std::exception& e) {
+    Logger()->error("Unable to save manifest: {}", e.what());
+  }
+}
+
+bool Manifest::isUnchanged(const FileStatus& status) const {
+  if (!status.valid)
+    return false;
+  std::lock_guard<std::mutex> guard(_mutex);
+  auto it = _entries.find(Key{status.device, status.inode});
+  return it != _entries.end() && it->second.success &&
+         it->second.size == status.size && it->second.mtime == status.mtime;
+}
+
+void Manifest::record(const std::filesystem::path& p, const std::string& output,
+                      bool success) {
+  Identity id;
+  if (!identify(p, id))
+    return;
+  std::lock_guard<std::mutex> guard(_mutex);
+  const Key key{id.device, id.inode};
+  _entries[key] = Entry{id.size, id.mtime, p.string(), output, success};
+  _recorded.insert(key);
+  _modified = true;
+}
+
+void Manifest::setPruning(bool prune) {
+  std::lock_guard<std::mutex> guard(_mutex);
+  _prune = prune;
+  _modified = _modified || prune;
+}
+
+void Manifest::save() {
+  std::lock_guard<std::mutex> guard(_mutex);
+  if (!_modified)
+    return;
+  // Other scans may have saved since this one loaded the file
+  auto lock = Cache::lockFile(_file);
+  auto entries = read(_file);
+  for (const auto& key : _recorded)
+    entries[key] = _entries.at(key);
+
+  auto exists = [](const std::string& p, const Key& key) {
+    Identity id;
+    return !p.empty() && identify(p, id) && id.device == key.first &&
+           id.inode == key.second;
+  };
+  json files = json::array();
+  for (auto it = entries.begin(); it != entries.end();) {
+    const auto& [key, entry] = *it;
+    // Failures are retried anyway, lost files would never match again.
+    // Only the files of this scan are checked unless pruning.
+    const bool checked = _prune || _recorded.count(key) > 0;
+    if (!entry.success ||
+        (checked && !exists(entry.input, key) && !exists(entry.output, key))) {
+      it = entries.erase(it);
+      continue;
+    }
+    files.push_back({{"device", key.first},
+                     {"inode", key.second},
+                     {"size", entry.size},
+                     {"mtime", entry.mtime},
+                     {"input", entry.input},
+                     {"output", entry.output},
+                     {"success", entry.success}});
+    ++it;
+  }
+  json j = {{"version", kVersion}, {"files", std::move(files)}};
+  atomicWrite(_file, j.dump());
+  _entries = std::move(entries);
+  _recorded.clear();
+  _modified = false;
+  Logger()->debug("Manifest {} saved with {} files", _file.string(),
+                  _entries.size());
+}
+
+size_t Manifest::size() const {
+  std::lock_guard<std::mutex> guard(_mutex);
+  return _entries.size();
+}
+
+} // namespace Explorer
+
+} // namespace TitleFinder
@@ -0,0 +1,117 @@
+/**
+ * @file explorer/manifest.hpp
+ *
+ * @brief Persistent record of already processed files
+ *
+ * @author Jordan Bieder
+ *
+ * @copyright Copyright (C) 2023 Jordan Bieder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+
+#include "explorer/statbatch.hpp"
+
+namespace TitleFinder {
+
+namespace Explorer {
+
+/**
+ * Files are identified by (device, inode) and considered unchanged while
+ * their size and modification time stay the same. A rename keeps both, so a
+ * file renamed by a previous scan is recognized as well.
+ */
+class Manifest {
+
+public:
+  struct Entry {
+    uint64_t size = 0;
+    int64_t mtime = 0; ///< nanoseconds
+    std::string input{};
+    std::string output{};
+    bool success = false;
+  };
+
+  /**
+   * Load the manifest stored in file if any.
+   */
+  explicit Manifest(const std::filesystem::path& file);
+
+  Manifest(const Manifest&) = delete;
+  Manifest& operator=(const Manifest&) = delete;
+
+  /**
+   * Destructor
+   * Saves pending modifications.
+   */
+  virtual ~Manifest();
+
+  /**
+   * @return true if the file of status was already processed successfully
+   * and did not change since. Failures are always retried.
+   */
+  bool isUnchanged(const FileStatus& status) const;
+
+  /**
+   * Record the outcome of processing p.
+   * Nothing is recorded if p cannot be stat'ed (e.g. it was moved).
+   */
+  void record(const std::filesystem::path& p, const std::string& output,
+              bool success);
+
+  /**
+   * Let save() check every entry, not only the recorded ones. It costs one
+   * or two stat calls per file of the manifest.
+   */
+  void setPruning(bool prune);
+
+  /**
+   * Merge the entries recorded here into the file, under a lock, so that
+   * concurrent scans keep each other's entries. Recorded failures and
+   * entries whose file is found neither at its input nor at its output
+   * anymore are dropped.
+   */
+  void save();
+
+  size_t size() const;
+
+private:
+  using Key = std::pair<uint64_t, uint64_t>;
+
+  /**
+   * Entries stored in file, none if it is missing or unreadable.
+   */
+  static std::map<Key, Entry> read(const std::filesystem::path& file);
+
+  std::filesystem::path _file;
+  std::map<Key, Entry> _entries;
+  std::set<Key> _recorded; ///< since the last save
+  mutable std::mutex _mutex;
+  bool _modified;
+  bool _prune;
+};
+
+} // namespace Explorer
+
+} // namespace TitleFinder
@@ -0,0 +1,194 @@
+/**
+ * @file explorer/mpmcqueue.hpp
+ *
+ * @brief Bounded lock free multi producer multi consumer queue
+ *
+ * @author Jordan Bieder
+ *
+ * @copyright Copyright (C) 2023 Jordan Bieder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <utility>
+
+namespace TitleFinder {
+
+namespace Explorer {
+
+/**
+ * Wait strategy for lock free loops: spin, then yield, then sleep longer
+ * and longer (up to 1 ms) while nothing happens.
+ */
+class Backoff {
+
+public:
+  inline void pause() {
+    if (_rounds < 16) {
+      ++_rounds;
+    } else if (_rounds < 32) {
+      ++_rounds;
+      std::this_thread::yield();
+    } else {
+      std::this_thread::sleep_for(std::chrono::microseconds(_sleep));
+      _sleep = std::min(_sleep * 2, 1000);
+    }
+  }
+
+  inline void reset() {
+    _rounds = 0;
+    _sleep = 10;
+  }
+
+private:
+  int _rounds = 0;
+  int _sleep = 10; ///< microseconds
+};
+
+/**
+ * Bounded queue after Dmitry Vyukov: every cell carries a sequence number
+ * telling whether it is ready to be written or read for a given turn, so
+ * producers and consumers only contend on their own index.
+ * T must be default constructible and movable.
+ */
+template <typename T>
+class MpmcQueue {
+
+public:
+  /**
+   * capacity is rounded up to a power of 2.
+   */
+  explicit MpmcQueue(size_t capacity)
+      : _cells(), _mask(0), _enqueue(0), _dequeue(0), _closed(false) {
+    size_t size = 2;
+    while (size < capacity)
+      size *= 2;
+    _cells = std::make_unique<Cell[]>(size);
+    for (size_t i = 0; i < size; ++i)
+      _cells[i].sequence.store(i, std::memory_order_relaxed);
+    _mask = size - 1;
+  }
+
+  MpmcQueue(const MpmcQueue&) = delete;
+  MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+  /**
+   * @return false if the queue is full.
+   */
+  bool tryPush(T& value) {
+    size_t pos = _enqueue.load(std::memory_order_relaxed);
+    while (true) {
+      Cell& cell = _cells[pos & _mask];
+      const size_t seq = cell.sequence.load(std::memory_order_acquire);
+      const auto diff =
+          static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+      if (diff == 0) {
+        if (_enqueue.compare_exchange_weak(pos, pos + 1,
+                                           std::memory_order_relaxed)) {
+          cell.value = std::move(value);
+          cell.sequence.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = _enqueue.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /**
+   * @return false if the queue is empty.
+   */
+  bool tryPop(T& value) {
+    size_t pos = _dequeue.load(std::memory_order_relaxed);
+    while (true) {
+      Cell& cell = _cells[pos & _mask];
+      const size_t seq = cell.sequence.load(std::memory_order_acquire);
+      const auto diff = static_cast<std::ptrdiff_t>(seq) -
+                        static_cast<std::ptrdiff_t>(pos + 1);
+      if (diff == 0) {
+        if (_dequeue.compare_exchange_weak(pos, pos + 1,
+                                           std::memory_order_relaxed)) {
+          value = std::move(cell.value);
+          cell.sequence.store(pos + _mask + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = _dequeue.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /**
+   * Push value, waiting for room.
+   */
+  void push(T value) {
+    Backoff backoff;
+    while (!this->tryPush(value))
+      backoff.pause();
+  }
+
+  /**
+   * Pop into value, waiting for an item.
+   * @return false once the queue is closed and empty.
+   */
+  bool pop(T& value) {
+    Backoff backoff;
+    while (!this->tryPop(value)) {
+      if (_closed.load(std::memory_order_acquire))
+        return this->tryPop(value);
+      backoff.pause();
+    }
+    return true;
+  }
+
+  /**
+   * No more items will be pushed.
+   */
+  inline void close() { _closed.store(true, std::memory_order_release); }
+
+  /**
+   * @return true once close() was called, items may still be left.
+   */
+  inline bool isClosed() const {
+    return _closed.load(std::memory_order_acquire);
+  }
+
+private:
+  struct alignas(64) Cell {
+    std::atomic<size_t> sequence{0};
+    T value{};
+  };
+
+  std::unique_ptr<Cell[]> _cells;
+  size_t _mask;
+  alignas(64) std::atomic<size_t> _enqueue;
+  alignas(64) std::atomic<size_t> _dequeue;
+  std::atomic<bool> _closed;
+};
+
+} // namespace Explorer
+
+} // namespace TitleFinder
@@ -27,33 +27,70 @@
 #include <fstream>
 #include <memory>
 #include <nlohmann/json.hpp>
-#include <regex>
 
+#include "explorer/hash.hpp"
 #include "explorer/logger.hpp"
+#include "explorer/normalize.hpp"
 
 using json = nlohmann::json;
 
 namespace {
 constexpr const char kReplacements[] = "replacements";
-const std::regex kProtection(R"(([\\\^\$\.\|\?\*\+\(\)\[\]\{\}]))");
+constexpr const char kArtifacts[] = "blacklist";
 } // namespace
 
 namespace TitleFinder {
 
 namespace Explorer {
 
-NameFilter::NameFilter(std::string_view blacklist) : _regex(), _db() {
+NameFilter::NameFilter(std::string_view blacklist,
+                       const std::filesystem::path& cacheDirectory)
+    : _patterns(), _automaton(), _db(), _content(), _parsed(true) {
   std::filesystem::path check(blacklist);
   if (!std::filesystem::exists(check)) {
     Logger()->error("Blacklist file {} does not seem to exist", blacklist);
   }
-  std::ifstream file{check, std::ios::in};
+  std::ifstream file{check, std::ios::in | std::ios::binary};
   if (!file.is_open()) {
     Logger()->error("Blacklist file {} cannot be opened", blacklist);
     return;
   }
+  file.seekg(0, std::ios::end);
+  _content.resize(static_cast<size_t>(file.tellg()));
+  file.seekg(0, std::ios::beg);
+  file.read(_content.data(), static_cast<std::streamsize>(_content.size()));
+  _parsed = false;
+
+  std::filesystem::path artifact;
+  if (!cacheDirectory.empty()) {
+    artifact = cacheDirectory / kArtifacts /
+               fmt::format("{:016x}.bin", fnv1a(_content));
+    if (_automaton.map(artifact)) {
+      Logger()->debug("Blacklist mapped from {}", artifact.string());
+      return;
+    }
+  }
+
+  this->parse();
+  _automaton = AhoCorasick(_patterns);
+  Logger()->debug("Blacklist compiled in {} states", _automaton.states());
+  if (!artifact.empty()) {
+    try {
+      _automaton.save(artifact);
+    } catch (const std::exception& e) {
+      Logger()->warn("Unable to save compiled blacklist: {}", e.what());
+    }
+  }
+}
+
+void NameFilter::parse() {
+  if (_parsed)
+    return;
+  _parsed = true;
+  const std::string content = std::move(_content);
+  _content.clear();
   try {
-    _db = nlohmann::json::parse(file);
+    _db = nlohmann::json::parse(content);
   } catch (const std::exception& e) {
     Logger()->critical("json parsing failed with {}", e.what());
     return;
@@ -66,42 +103,30 @@ NameFilter::NameFilter(std::string_view blacklist) : _regex(), _db() {
     Logger()->error("Replacements is not an array");
     return;
   }
-  _regex.resize(_db[kReplacements].size());
-  int i = 0;
   for (const auto& r : _db[kReplacements]) {
-    std::string source =
-        std::regex_replace(r.value("source", ""), kProtection, "\\$1",
-                           std::regex_constants::match_any);
+    std::string source = r.value("source", "");
     if (source.empty())
       continue;
     std::string replacement = r.value("replacement", "");
-    bool casesensitive = r["casesensitive"];
+    bool casesensitive = r.value("casesensitive", false);
     Logger()->trace("source: {: <20s}, replacement {: <20s}", source,
                     replacement);
-    _regex[i++] = std::move(
-        std::make_pair(std::regex(source, casesensitive ? std::regex::ECMAScript
-                                                        : std::regex::icase),
-                       replacement));
+    _patterns.push_back(
+        {std::move(source), std::move(replacement), casesensitive});
   }
-  _regex.resize(i);
 }
 
-std::string NameFilter::filter(const std::string& input) {
-  std::string output(input);
-  std::regex trim(R"(\.+)");
-  for (const auto& r : _regex) {
-    Logger()->trace("Intermediate replacement: {}", output);
-    output = std::regex_replace(output, r.first, r.second);
-  }
-  output =
-      std::regex_replace(output, trim, ".", std::regex_constants::match_any);
-  return output;
+std::string NameFilter::filter(const std::string& input) const {
+  const std::string output = _automaton.replace(input);
+  Logger()->trace("Replaced: {}", output);
+  return collapseRuns(output, '.');
 }
 
 void NameFilter::add(const std::string& source, const std::string& replacement,
                      bool casesensitive) {
   if (source.empty())
     return;
+  this->parse();
   json item = {{"source", source},
                {"replacement", replacement},
                {"casesensitive", casesensitive}};
@@ -110,17 +135,14 @@ void NameFilter::add(const std::string& source, const std::string& replacement,
     _db[kReplacements] = json::array();
 
   _db[kReplacements].push_back(std::move(item));
-  std::regex_replace(source, kProtection, "\\$1",
-                     std::regex_constants::match_any);
   Logger()->trace("source: {: <20s}, replacement {: <20s}", source,
                   replacement);
-  _regex.push_back(std::move(
-      std::make_pair(std::regex(source, casesensitive ? std::regex::ECMAScript
-                                                      : std::regex::icase),
-                     replacement)));
+  _patterns.push_back({source, replacement, casesensitive});
+  _automaton = AhoCorasick(_patterns);
 }
 
 void NameFilter::dump(const std::string& filename) {
+  this->parse();
   std::ofstream output(filename, std::ios::out);
   if (!output.is_open())
     throw std::runtime_error(fmt::format("Unable to open file {}", filename));
@@ -23,31 +23,41 @@
 
 #pragma once
 
+#include <filesystem>
 #include <memory>
 #include <nlohmann/json.hpp>
-#include <regex>
+#include <string>
 #include <string_view>
-#include <utility>
 #include <vector>
 
+#include "explorer/ahocorasick.hpp"
+
 namespace TitleFinder {
 
 namespace Explorer {
 
+/**
+ * Literal replacements read from a JSON blacklist, all applied in one pass
+ * by an Aho-Corasick automaton.
+ * With a cache directory the compiled automaton is saved under the hash of
+ * the blacklist content and mapped back on the next start; the JSON is then
+ * only parsed if the blacklist is modified or dumped.
+ */
 class NameFilter {
 
 public:
   /**
    * Empty constructor
    */
-  explicit NameFilter(std::string_view blacklist);
+  explicit NameFilter(std::string_view blacklist,
+                      const std::filesystem::path& cacheDirectory = {});
 
   /**
    * Destructor
    */
   virtual ~NameFilter() = default;
 
-  std::string filter(const std::string& input);
+  std::string filter(const std::string& input) const;
 
   void add(const std::string& source, const std::string& replacement,
            bool casesensitive);
@@ -55,8 +65,13 @@ public:
   void dump(const std::string& filename);
 
 private:
-  std::vector<std::pair<std::regex, std::string>> _regex;
+  void parse();
+
+  std::vector<AhoCorasick::Pattern> _patterns;
+  AhoCorasick _automaton;
   nlohmann::json _db;
+  std::string _content; ///< blacklist not parsed yet
+  bool _parsed;
 };
 
 } // namespace Explorer
@@ -0,0 +1,217 @@
+/**
+ * @file explorer/normalize.cpp
+ *
+ * @brief Title normalization with a vectorized ASCII path
+ *
+ * @author Jordan Bieder
+ *
+ * @copyright Copyright (C) 2023 Jordan Bieder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "explorer/normalize.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// ASCII replacement of U+00C0 to U+017F. Upper case letters stand for two
+// characters (see expand) and a space for a separator.
+constexpr char kLatin[] =
+    // U+00C0 - U+00FF
+    "aaaaaaEceeeeiiiidnooooo ouuuuyTS"
+    "aaaaaaEceeeeiiiidnooooo ouuuuyTy"
+    // U+0100 - U+017F
+    "aaaaaaccccccccddddeeeeeeeeeegggggggghhhhiiiiiiiiiiJJjjkkkllllllllll"
+    "nnnnnnnnnooooooOOrrrrrrssssssssttttttuuuuuuuuuuuuwwyyyzzzzzzs";
+static_assert(sizeof(kLatin) == 192 + 1, "One entry per code point");
+
+const char* expand(char c) {
+  switch (c) {
+  case 'E':
+    return "ae";
+  case 'J':
+    return "ij";
+  case 'O':
+    return "oe";
+  case 'S':
+    return "ss";
+  case 'T':
+    return "th";
+  default:
+    return nullptr;
+  }
+}
+
+inline bool isAlnum(unsigned char c) {
+  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+         (c >= 'A' && c <= 'Z');
+}
+
+inline char lower(unsigned char c) {
+  return static_cast<char>(c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c);
+}
+
+class Writer {
+public:
+  explicit Writer(std::string& output) : _output(output), _pending(false) {}
+
+  inline void separate() { _pending = true; }
+
+  inline void put(char c) {
+    if (_pending && !_output.empty())
+      _output.push_back(' ');
+    _pending = false;
+    _output.push_back(c);
+  }
+
+  inline void put(const char* s, size_t n) {
+    if (_pending && !_output.empty())
+      _output.push_back(' ');
+    _pending = false;
+    _output.append(s, n);
+  }
+
+private:
+  std::string& _output;
+  bool _pending;
+};
+
+/**
+ * Handle the character at input[i] and return the number of bytes consumed.
+ */
+size_t scalar(std::string_view input, size_t i, Writer& out) {
+  const auto c = static_cast<unsigned char>(input[i]);
+  if (c < 0x80) {
+    if (isAlnum(c))
+      out.put(lower(c));
+    else if (c != '\'')
+      out.separate();
+    return 1;
+  }
+  const size_t left = input.size() - i;
+  const auto c1 = left > 1 ? static_cast<unsigned char>(input[i + 1]) : 0;
+  if (c >= 0xC3 && c <= 0xC5 && (c1 & 0xC0) == 0x80) {
+    const char r = kLatin[(c - 0xC3) << 6 | (c1 & 0x3F)];
+    if (r == ' ')
+      out.separate();
+    else if (const char* e = expand(r))
+      out.put(e, 2);
+    else
+      out.put(r);
+    return 2;
+  }
+  // General punctuation block: quotes are dropped like the apostrophe,
+  // dashes and the rest act as separators.
+  if (c == 0xE2 && c1 == 0x80 && left > 2 &&
+      (static_cast<unsigned char>(input[i + 2]) & 0xC0) == 0x80) {
+    const auto c2 = static_cast<unsigned char>(input[i + 2]);
+    if (c2 != 0x98 && c2 != 0x99)
+      out.separate();
+    return 3;
+  }
+  // Anything else is copied as is
+  out.put(static_cast<char>(c));
+  return 1;
+}
+
+} // namespace
+
+namespace TitleFinder {
+
+namespace Explorer {
+
+std::string normalizeTitle(std::string_view input) {
+  std::string output;
+  output.reserve(input.size());
+  Writer out(output);
+  size_t i = 0;
+#ifdef __SSE2__
+  // 16 bytes at a time while the text is pure ASCII: lower case and classify
+  // the whole block at once, then only walk the separators.
+  const __m128i upperLow = _mm_set1_epi8('A' - 1);
+  const __m128i upperHigh = _mm_set1_epi8('Z' + 1);
+  const __m128i lowerLow = _mm_set1_epi8('a' - 1);
+  const __m128i lowerHigh = _mm_set1_epi8('z' + 1);
+  const __m128i digitLow = _mm_set1_epi8('0' - 1);
+  const __m128i digitHigh = _mm_set1_epi8('9' + 1);
+  const __m128i caseBit = _mm_set1_epi8('a' - 'A');
+  while (i + 16 <= input.size()) {
+    const __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(input.data() + i));
+    if (_mm_movemask_epi8(v) != 0) {
+      // Non ASCII byte somewhere: handle one character and try again
+      i += scalar(input, i, out);
+      continue;
+    }
+    // Signed comparisons are fine since every byte is below 0x80
+    const __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, upperLow),
+                                        _mm_cmplt_epi8(v, upperHigh));
+    const __m128i lowerCase = _mm_and_si128(_mm_cmpgt_epi8(v, lowerLow),
+                                            _mm_cmplt_epi8(v, lowerHigh));
+    const __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, digitLow),
+                                        _mm_cmplt_epi8(v, digitHigh));
+    const __m128i folded = _mm_add_epi8(v, _mm_and_si128(upper, caseBit));
+    const auto keep = static_cast<unsigned>(_mm_movemask_epi8(
+        _mm_or_si128(_mm_or_si128(upper, lowerCase), digit)));
+    alignas(16) char block[16];
+    _mm_store_si128(reinterpret_cast<__m128i*>(block), folded);
+    // Copy each run of letters and digits at once
+    for (unsigned b = 0; b < 16;) {
+      if (keep & (1u << b)) {
+        const auto run = static_cast<unsigned>(__builtin_ctz(~(keep >> b)));
+        out.put(block + b, run);
+        b += run;
+      } else {
+        if (block[b] != '\'')
+          out.separate();
+        ++b;
+      }
+    }
+    i += 16;
+  }
+#endif
+  while (i < input.size())
+    i += scalar(input, i, out);
+  return output;
+}
+
+std::string collapseRuns(std::string_view input, char c) {
+  std::string output;
+  output.reserve(input.size());
+  size_t i = 0;
+  while (i < input.size()) {
+    const void* found = std::memchr(input.data() + i, c, input.size() - i);
+    const size_t end = found ? static_cast<const char*>(found) - input.data()
+                             : input.size();
+    output.append(input.data() + i, end - i);
+    if (end == input.size())
+      break;
+    output.push_back(c);
+    i = end;
+    while (i < input.size() && input[i] == c)
+      ++i;
+  }
+  return output;
+}
+
+} // namespace Explorer
+
+} // namespace TitleFinder
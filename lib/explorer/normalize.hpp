@@ -0,0 +1,48 @@
+/**
+ * @file explorer/normalize.hpp
+ *
+ * @brief Title normalization shared by matching and searching
+ *
+ * @author Jordan Bieder
+ *
+ * @copyright Copyright (C) 2023 Jordan Bieder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+
+namespace TitleFinder {
+
+namespace Explorer {
+
+/**
+ * Canonical form of a title used to search and compare names: ASCII lower
+ * case, Latin-1 and Latin Extended-A diacritics removed, apostrophes dropped
+ * and any other run of punctuation or blanks turned into a single space.
+ * Other UTF-8 sequences are kept untouched.
+ */
+std::string normalizeTitle(std::string_view input);
+
+/**
+ * Replace every run of c in input by a single c.
+ */
+std::string collapseRuns(std::string_view input, char c);
+
+} // namespace Explorer
+
+} // namespace TitleFinder
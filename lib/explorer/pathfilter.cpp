@@ -0,0 +1,208 @@
+/**
+ * @file explorer/pathfilter.cpp
+ *
+ * @brief Include and exclude rules for scanned paths
+ *
+ * @author Jordan Bieder
+ *
+ * @copyright Copyright (C) 2023 Jordan Bieder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "explorer/pathfilter.hpp"
+
+#include <fmt/format.h>
+#include <stdexcept>
+
+namespace {
+
+constexpr size_t npos = std::string_view::npos;
+
+/**
+ * Match c against the class starting at pattern[i] == '['.
+ * @return the position after the class, or npos if c is not in it or the
+ * class is not closed.
+ */
+size_t matchClass(std::string_view pattern, size_t i, char c) {
+  ++i;
+  const bool negate = i < pattern.size() && (pattern[i] == '!' ||
+                                             pattern[i] == '^');
+  if (negate)
+    ++i;
+  bool found = false;
+  // A ']' right after the opening is a member
+  for (bool first = true; i < pattern.size() && (first || pattern[i] != ']');
+       first = false) {
+    const char low = pattern[i];
+    char high = low;
+    if (i + 2 < pattern.size() && pattern[i + 1] == '-' &&
+        pattern[i + 2] != ']') {
+      high = pattern[i + 2];
+      i += 3;
+    } else {
+      ++i;
+    }
+    if (c >= low && c <= high)
+      found = true;
+  }
+  if (i >= pattern.size())
+    return npos;
+  return found != negate ? i + 1 : npos;
+}
+
+bool hasWildcard(std::string_view s) {
+  return s.find_first_of("*?[\\") != npos;
+}
+
+} // namespace
+
+namespace TitleFinder {
+
+namespace Explorer {
+
+bool globMatch(std::string_view pattern, std::string_view name) {
+  size_t p = 0;
+  size_t n = 0;
+  while (p < pattern.size()) {
+    const char c = pattern[p];
+    if (c == '*') {
+      const bool crosses = p + 1 < pattern.size() && pattern[p + 1] == '*';
+      const std::string_view rest = pattern.substr(p + (crosses ? 2 : 1));
+      // Try every length for the star, shortest first
+      for (size_t k = n; k <= name.size(); ++k) {
+        if (globMatch(rest, name.substr(k)))
+          return true;
+        if (k < name.size() && name[k] == '/' && !crosses)
+          return false;
+      }
+      return false;
+    }
+    if (n >= name.size())
+      return false;
+    if (c == '?') {
+      if (name[n] == '/')
+        return false;
+      ++p;
+    } else if (c == '[') {
+      if (name[n] == '/' || (p = matchClass(pattern, p, name[n])) == npos)
+        return false;
+    } else if (c == '\\' && p + 1 < pattern.size()) {
+      if (pattern[p + 1] != name[n])
+        return false;
+      p += 2;
+    } else {
+      if (c != name[n])
+        return false;
+      ++p;
+    }
+    ++n;
+  }
+  return n == name.size();
+}
+
+bool PathFilter::Rule::matches(std::string_view relative,
+                               std::string_view name, bool folder) const {
+  if (folderOnly && !folder)
+    return false;
+  switch (kind) {
+  case Kind::Name:
+    return (wholePath ? relative : name) == text;
+  case Kind::Suffix:
+    return name.size() >= text.size() &&
+           name.substr(name.size() - text.size()) == text;
+  case Kind::Glob:
+    return globMatch(text, wholePath ? relative : name);
+  case Kind::Regex:
+    if (folder)
+      return std::regex_search(std::string(relative) + '/', *regex);
+    return std::regex_search(relative.begin(), relative.end(), *regex);
+  }
+  return false;
+}
+
+PathFilter::PathFilter() : _includes(), _excludes() {}
+
+PathFilter::Rule PathFilter::compile(std::string_view pattern) {
+  Rule rule{Rule::Kind::Glob, false, false, {}, nullptr};
+  if (pattern.substr(0, 3) == "re:") {
+    rule.kind = Rule::Kind::Regex;
+    rule.text.assign(pattern.substr(3));
+    try {
+      rule.regex = std::make_shared<std::regex>(
+          rule.text, std::regex::ECMAScript | std::regex::optimize);
+    } catch (const std::regex_error& e) {
+      throw std::invalid_argument(
+          fmt::format("Invalid expression {}: {}", rule.text, e.what()));
+    }
+    return rule;
+  }
+
+  if (!pattern.empty() && pattern.back() == '/') {
+    rule.folderOnly = true;
+    pattern.remove_suffix(1);
+  }
+  if (!pattern.empty() && pattern.front() == '/')
+    pattern.remove_prefix(1);
+  if (pattern.empty())
+    throw std::invalid_argument("Empty pattern");
+  rule.wholePath = pattern.find('/') != npos;
+  rule.text.assign(pattern);
+  // Most rules are plain names or extensions: no need for globMatch
+  if (!hasWildcard(pattern)) {
+    rule.kind = Rule::Kind::Name;
+  } else if (!rule.wholePath && pattern[0] == '*' &&
+             !hasWildcard(pattern.substr(1))) {
+    rule.kind = Rule::Kind::Suffix;
+    rule.text.erase(0, 1);
+  }
+  return rule;
+}
+
+void PathFilter::include(std::string_view pattern) {
+  _includes.push_back(compile(pattern));
+}
+
+void PathFilter::exclude(std::string_view pattern) {
+  _excludes.push_back(compile(pattern));
+}
+
+void PathFilter::clearIncludes() { _includes.clear(); }
+
+bool PathFilter::matchesAny(const std::vector<Rule>& rules,
+                            std::string_view relative, bool folder) {
+  std::string_view name(relative);
+  const size_t slash = name.rfind('/');
+  if (slash != npos)
+    name.remove_prefix(slash + 1);
+  for (const auto& rule : rules) {
+    if (rule.matches(relative, name, folder))
+      return true;
+  }
+  return false;
+}
+
+bool PathFilter::selects(std::string_view relative) const {
+  if (!_includes.empty() && !matchesAny(_includes, relative, false))
+    return false;
+  return !matchesAny(_excludes, relative, false);
+}
+
+bool PathFilter::prunes(std::string_view relative) const {
+  return matchesAny(_excludes, relative, true);
+}
+
+} // namespace Explorer
+
+} // namespace TitleFinder
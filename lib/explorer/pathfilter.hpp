@@ -0,0 +1,112 @@
+/**
+ * @file explorer/pathfilter.hpp
+ *
+ * @brief Include and exclude rules for scanned paths
+ *
+ * @author Jordan Bieder
+ *
+ * @copyright Copyright (C) 2023 Jordan Bieder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace TitleFinder {
+
+namespace Explorer {
+
+/**
+ * Include and exclude rules matched against paths relative to the scanned
+ * folder, compiled once when added.
+ * A rule is a glob where '*' and '?' stay within a folder name, "**"
+ * crosses folders and "[a-z]", "[!0-9]" are classes, or a regular
+ * expression prefixed with "re:" searched in the whole relative path,
+ * which ends with '/' for a folder.
+ * Like in .gitignore, a glob ending with '/' only matches folders and a
+ * glob without '/' matches the last name of the path at any depth.
+ * Files must match an include rule (any file if there is none) and no
+ * exclude rule; excluded folders are not entered.
+ */
+class PathFilter {
+
+public:
+  /**
+   * Empty constructor
+   */
+  PathFilter();
+
+  /**
+   * Destructor
+   */
+  virtual ~PathFilter() = default;
+
+  /**
+   * @throw std::invalid_argument if pattern is an invalid expression.
+   */
+  void include(std::string_view pattern);
+
+  /**
+   * @throw std::invalid_argument if pattern is an invalid expression.
+   */
+  void exclude(std::string_view pattern);
+
+  void clearIncludes();
+
+  /**
+   * @return true if the file at relative is to be scanned.
+   */
+  bool selects(std::string_view relative) const;
+
+  /**
+   * @return true if the folder at relative must not be entered.
+   */
+  bool prunes(std::string_view relative) const;
+
+private:
+  struct Rule {
+    enum class Kind { Name, Suffix, Glob, Regex };
+    Kind kind;
+    bool folderOnly;
+    bool wholePath; ///< match the relative path instead of its last name
+    std::string text;
+    std::shared_ptr<std::regex> regex;
+
+    bool matches(std::string_view relative, std::string_view name,
+                 bool folder) const;
+  };
+
+  static Rule compile(std::string_view pattern);
+
+  static bool matchesAny(const std::vector<Rule>& rules,
+                         std::string_view relative, bool folder);
+
+  std::vector<Rule> _includes;
+  std::vector<Rule> _excludes;
+};
+
+/**
+ * Match name against a glob (see PathFilter).
+ */
+bool globMatch(std::string_view pattern, std::string_view name);
+
+} // namespace Explorer
+
+} // namespace TitleFinder
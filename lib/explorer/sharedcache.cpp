@@ -0,0 +1,255 @@
+/**
+ * @file explorer/sharedcache.cpp
+ *
+ * @brief Sequence-locked slots in a POSIX shared memory segment
+ *
+ * @author Jordan Bieder
+ *
+ * @copyright Copyright (C) 2023 Jordan Bieder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "explorer/sharedcache.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "explorer/hash.hpp"
+#include "explorer/logger.hpp"
+
+namespace {
+
+constexpr uint64_t kMagic = 0x5446534843414348ULL; // TFSHCACH
+constexpr uint32_t kVersion = 2;
+constexpr size_t kProbes = 4;
+// A slot owned longer than that belongs to a writer that died
+constexpr int64_t kStaleWriter = 10; // seconds
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "Shared memory requires address-free 64 bits atomics");
+
+uint64_t keyHash(std::string_view s) {
+  const uint64_t h = TitleFinder::Explorer::fnv1a(s);
+  // 0 marks an empty slot
+  return h == 0 ? 1 : h;
+}
+
+int64_t now() {
+  return std::chrono::duration_cast<std::chrono::seconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+/**
+ * Slot sequences hold the time of their last claim in the high half and a
+ * counter in the low half, odd while a writer owns the slot.
+ * @return the sequence claiming a slot at sequence, odd.
+ */
+uint64_t claim(uint64_t sequence) {
+  const uint32_t counter = static_cast<uint32_t>(sequence);
+  return static_cast<uint64_t>(now()) << 32 |
+         static_cast<uint32_t>(counter + ((counter & 1) ? 2 : 1));
+}
+
+inline bool stale(uint64_t sequence) {
+  return (sequence & 1) &&
+         now() - static_cast<int64_t>(sequence >> 32) > kStaleWriter;
+}
+
+} // namespace
+
+namespace TitleFinder {
+
+namespace Explorer {
+
+struct SharedCache::Header {
+  std::atomic<uint64_t> magic;
+  uint32_t version;
+  uint32_t slots;
+  uint32_t slotSize;
+  uint32_t reserved;
+};
+
+struct SharedCache::Slot {
+  std::atomic<uint64_t> sequence; // see claim()
+  std::atomic<uint64_t> hash;
+  std::atomic<int64_t> timestamp;
+  std::atomic<uint32_t> keyLength;
+  std::atomic<uint32_t> valueLength;
+  // followed by the key then the value
+  inline char* payload() { return reinterpret_cast<char*>(this + 1); }
+};
+
+SharedCache::SharedCache(std::string_view name, uint32_t slots,
+                         uint32_t slotSize)
+    : _header(nullptr), _size(0) {
+  const size_t size = sizeof(Header) + static_cast<size_t>(slots) * slotSize;
+  const std::string shmName(name);
+  int fd = ::shm_open(shmName.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    Logger()->warn("Unable to open shared memory {}: {}", shmName,
+                   std::strerror(errno));
+    return;
+  }
+  // Whoever sizes and initializes the segment does it under the lock, which
+  // goes away with its process if it dies meanwhile
+  if (::flock(fd, LOCK_EX) != 0)
+    Logger()->debug("Unable to lock shared memory {}: {}", shmName,
+                    std::strerror(errno));
+  struct stat st;
+  if (::fstat(fd, &st) == 0 && st.st_size == 0 &&
+      ::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+    Logger()->warn("Unable to size shared memory {}: {}", shmName,
+                   std::strerror(errno));
+    ::close(fd);
+    return;
+  }
+  if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) != size) {
+    Logger()->warn("Shared memory {} has an unexpected size", shmName);
+    ::close(fd);
+    return;
+  }
+  void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED) {
+    Logger()->warn("Unable to map shared memory {}: {}", shmName,
+                   std::strerror(errno));
+    ::close(fd);
+    return;
+  }
+
+  auto* header = static_cast<Header*>(p);
+  if (header->magic.load(std::memory_order_acquire) == 0) {
+    header->version = kVersion;
+    header->slots = slots;
+    header->slotSize = slotSize;
+    header->magic.store(kMagic, std::memory_order_release);
+  }
+  // The mapping keeps the file open: unlock explicitly
+  ::flock(fd, LOCK_UN);
+  ::close(fd);
+  if (header->magic.load(std::memory_order_acquire) != kMagic ||
+      header->version != kVersion || header->slots != slots ||
+      header->slotSize != slotSize) {
+    Logger()->warn("Shared memory {} is not compatible", shmName);
+    ::munmap(p, size);
+    return;
+  }
+  _header = header;
+  _size = size;
+  Logger()->debug("Shared cache {} mapped ({} slots)", shmName, slots);
+}
+
+SharedCache::~SharedCache() {
+  if (_header)
+    ::munmap(_header, _size);
+}
+
+SharedCache::Slot* SharedCache::slot(size_t i) const {
+  return reinterpret_cast<Slot*>(reinterpret_cast<char*>(_header) +
+                                 sizeof(Header) + i * _header->slotSize);
+}
+
+bool SharedCache::get(std::string_view key, std::string& value,
+                      std::chrono::seconds maxAge) const {
+  if (!_header)
+    return false;
+  const uint64_t h = keyHash(key);
+  const size_t capacity = _header->slotSize - sizeof(Slot);
+  for (size_t k = 0; k < kProbes; ++k) {
+    Slot* s = this->slot((h + k) % _header->slots);
+    const uint64_t before = s->sequence.load(std::memory_order_acquire);
+    if ((before & 1) || s->hash.load(std::memory_order_relaxed) != h)
+      continue;
+    const uint32_t keyLength = s->keyLength.load(std::memory_order_relaxed);
+    const uint32_t valueLength =
+        s->valueLength.load(std::memory_order_relaxed);
+    const int64_t timestamp = s->timestamp.load(std::memory_order_relaxed);
+    if (keyLength != key.size() ||
+        static_cast<size_t>(keyLength) + valueLength > capacity)
+      continue;
+    const bool same = std::memcmp(s->payload(), key.data(), keyLength) == 0;
+    if (same)
+      value.assign(s->payload() + keyLength, valueLength);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (s->sequence.load(std::memory_order_relaxed) != before || !same)
+      continue;
+    return now() - timestamp <= maxAge.count();
+  }
+  return false;
+}
+
+bool SharedCache::put(std::string_view key, std::string_view value,
+                      std::chrono::system_clock::time_point written) {
+  if (!_header)
+    return false;
+  const size_t capacity = _header->slotSize - sizeof(Slot);
+  if (key.size() + value.size() > capacity)
+    return false;
+  const uint64_t h = keyHash(key);
+
+  Slot* target = nullptr;
+  int64_t oldest = INT64_MAX;
+  for (size_t k = 0; k < kProbes; ++k) {
+    Slot* s = this->slot((h + k) % _header->slots);
+    if (s->hash.load(std::memory_order_relaxed) == h) {
+      target = s;
+      break;
+    }
+    const int64_t timestamp = s->timestamp.load(std::memory_order_relaxed);
+    if (timestamp < oldest) {
+      oldest = timestamp;
+      target = s;
+    }
+  }
+
+  // An odd sequence is a busy writer, or a dead one after kStaleWriter
+  uint64_t sequence = target->sequence.load(std::memory_order_relaxed);
+  const uint64_t owned = claim(sequence);
+  if (((sequence & 1) && !stale(sequence)) ||
+      !target->sequence.compare_exchange_strong(sequence, owned,
+                                                std::memory_order_acquire))
+    return false;
+  std::atomic_thread_fence(std::memory_order_release);
+  target->hash.store(h, std::memory_order_relaxed);
+  target->timestamp.store(std::chrono::duration_cast<std::chrono::seconds>(
+                              written.time_since_epoch())
+                              .count(),
+                          std::memory_order_relaxed);
+  target->keyLength.store(static_cast<uint32_t>(key.size()),
+                          std::memory_order_relaxed);
+  target->valueLength.store(static_cast<uint32_t>(value.size()),
+                            std::memory_order_relaxed);
+  std::memcpy(target->payload(), key.data(), key.size());
+  std::memcpy(target->payload() + key.size(), value.data(), value.size());
+  // Still ours unless we were too slow and taken for dead
+  uint64_t expected = owned;
+  return target->sequence.compare_exchange_strong(expected, owned + 1,
+                                                  std::memory_order_release);
+}
+
+std::string SharedCache::defaultName() {
+  // Incompatible versions never share a segment
+  return fmt::format("/{}-{}-v{}", TITLEFINDER_NAME, ::getuid(), kVersion);
+}
+
+} // namespace Explorer
+
+} // namespace TitleFinder
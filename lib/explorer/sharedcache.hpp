@@ -0,0 +1,98 @@
+/**
+ * @file explorer/sharedcache.hpp
+ *
+ * @brief Lock-free hash table in POSIX shared memory shared by all processes
+ *
+ * @author Jordan Bieder
+ *
+ * @copyright Copyright (C) 2023 Jordan Bieder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace TitleFinder {
+
+namespace Explorer {
+
+/**
+ * Fixed size table of recently used entries.
+ * Each slot is protected by a sequence counter: readers never block and
+ * retry or miss if a writer is busy, writers never wait and simply skip a
+ * slot claimed by someone else, unless its writer seems dead. Entries larger
+ * than a slot are not shared.
+ */
+class SharedCache {
+
+public:
+  /**
+   * Map (and create if needed) the segment called name.
+   * isOpen() tells if it worked.
+   */
+  explicit SharedCache(std::string_view name, uint32_t slots = kSlots,
+                       uint32_t slotSize = kSlotSize);
+
+  SharedCache(const SharedCache&) = delete;
+  SharedCache& operator=(const SharedCache&) = delete;
+
+  /**
+   * Destructor
+   */
+  virtual ~SharedCache();
+
+  inline bool isOpen() const { return _header != nullptr; }
+
+  /**
+   * Copy the value of key into value if present and younger than maxAge.
+   */
+  bool get(std::string_view key, std::string& value,
+           std::chrono::seconds maxAge) const;
+
+  /**
+   * Publish value for key, written at the given time, replacing the
+   * oldest entry of its bucket.
+   * @return false if the value is too large or the bucket is busy.
+   */
+  bool put(std::string_view key, std::string_view value,
+           std::chrono::system_clock::time_point written =
+               std::chrono::system_clock::now());
+
+  /**
+   * Default name of the segment for the current user.
+   */
+  static std::string defaultName();
+
+  static constexpr uint32_t kSlots = 512;
+  static constexpr uint32_t kSlotSize = 64 * 1024;
+
+private:
+  struct Header;
+  struct Slot;
+
+  Slot* slot(size_t i) const;
+
+  Header* _header;
+  size_t _size;
+};
+
+} // namespace Explorer
+
+} // namespace TitleFinder
@@ -0,0 +1,195 @@
+/**
+ * @file explorer/similarity.cpp
+ *
+ * @brief Word based title similarity
+ *
+ * @author Jordan Bieder
+ *
+ * @copyright Copyright (C) 2023 Jordan Bieder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "explorer/similarity.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#include "explorer/hash.hpp"
+#include "explorer/normalize.hpp"
+
+namespace {
+
+// Share of the final score given to each criterion
+constexpr double kNameWeight = 0.8;
+constexpr double kPopularityWeight = 0.1;
+constexpr double kYearWeight = 0.1;
+
+constexpr double kWinklerScale = 0.1;
+constexpr size_t kWinklerPrefix = 4;
+
+void join(std::string& out, std::string_view word) {
+  if (!out.empty())
+    out.push_back(' ');
+  out.append(word);
+}
+
+} // namespace
+
+namespace TitleFinder {
+
+namespace Explorer {
+
+double jaroWinkler(std::string_view a, std::string_view b) {
+  if (a.empty() && b.empty())
+    return 1.;
+  if (a.empty() || b.empty())
+    return 0.;
+  if (a.size() > b.size())
+    std::swap(a, b);
+
+  const size_t window = std::max<size_t>(b.size() / 2, 1) - 1;
+  std::vector<char> used(b.size(), 0);
+  std::vector<char> matched(a.size(), 0);
+  size_t matches = 0;
+  for (size_t i = 0; i < a.size(); ++i) {
+    const size_t first = i > window ? i - window : 0;
+    const size_t last = std::min(i + window + 1, b.size());
+    for (size_t j = first; j < last; ++j) {
+      if (!used[j] && a[i] == b[j]) {
+        used[j] = matched[i] = 1;
+        ++matches;
+        break;
+      }
+    }
+  }
+  if (matches == 0)
+    return 0.;
+
+  size_t transpositions = 0;
+  for (size_t i = 0, j = 0; i < a.size(); ++i) {
+    if (!matched[i])
+      continue;
+    while (!used[j])
+      ++j;
+    if (a[i] != b[j++])
+      ++transpositions;
+  }
+  const double m = static_cast<double>(matches);
+  const double jaro =
+      (m / a.size() + m / b.size() + (m - transpositions / 2.) / m) / 3.;
+
+  size_t prefix = 0;
+  while (prefix < kWinklerPrefix && prefix < a.size() &&
+         a[prefix] == b[prefix])
+    ++prefix;
+  return jaro + prefix * kWinklerScale * (1. - jaro);
+}
+
+TokenSignature::TokenSignature(const std::string& title)
+    : _text(normalizeTitle(title)), _tokens() {
+  std::string_view text(_text);
+  size_t begin = 0;
+  while (begin < text.size()) {
+    size_t end = text.find(' ', begin);
+    if (end == std::string_view::npos)
+      end = text.size();
+    const std::string_view word = text.substr(begin, end - begin);
+    _tokens.push_back({fnv1a(word), static_cast<uint32_t>(begin),
+                       static_cast<uint32_t>(word.size())});
+    begin = end + 1;
+  }
+  std::sort(_tokens.begin(), _tokens.end(),
+            [](const Token& l, const Token& r) { return l.hash < r.hash; });
+  _tokens.erase(std::unique(_tokens.begin(), _tokens.end(),
+                            [](const Token& l, const Token& r) {
+                              return l.hash == r.hash;
+                            }),
+                _tokens.end());
+}
+
+double TokenSignature::similarity(const TokenSignature& other) const {
+  // Split both sides in common words and remaining words, all in hash order
+  std::string common;
+  std::string left;
+  std::string right;
+  auto l = _tokens.begin();
+  auto r = other._tokens.begin();
+  while (l != _tokens.end() || r != other._tokens.end()) {
+    if (r == other._tokens.end() ||
+        (l != _tokens.end() && l->hash < r->hash)) {
+      join(left, word(*l++));
+    } else if (l == _tokens.end() || r->hash < l->hash) {
+      join(right, other.word(*r++));
+    } else {
+      join(common, word(*l));
+      ++l;
+      ++r;
+    }
+  }
+  if (common.empty())
+    return jaroWinkler(left, right);
+
+  std::string withLeft(common);
+  std::string withRight(common);
+  if (!left.empty())
+    join(withLeft, left);
+  if (!right.empty())
+    join(withRight, right);
+  return std::max({jaroWinkler(common, withLeft),
+                   jaroWinkler(common, withRight),
+                   jaroWinkler(withLeft, withRight)});
+}
+
+std::pair<size_t, size_t> bestTokenMatch(const std::vector<Candidate>& list,
+                                         const std::string& title, int year) {
+  if (list.empty())
+    return std::make_pair(0, 0);
+
+  const TokenSignature user(title);
+  std::vector<TokenSignature> signatures;
+  signatures.reserve(list.size());
+  double maxPopularity = 0.;
+  for (const auto& candidate : list) {
+    signatures.emplace_back(candidate.name);
+    maxPopularity = std::max(maxPopularity, candidate.popularity);
+  }
+  const double popularityScale =
+      maxPopularity > 0. ? 1. / std::log1p(maxPopularity) : 0.;
+
+  size_t id = 0;
+  double best = -1.;
+  for (size_t i = 0; i < list.size(); ++i) {
+    double score = kNameWeight * user.similarity(signatures[i]);
+    if (list[i].popularity > 0.)
+      score += kPopularityWeight * std::log1p(list[i].popularity) *
+               popularityScale;
+    if (year != -1 && list[i].year != -1)
+      score += kYearWeight / (1. + std::abs(year - list[i].year));
+    if (score > best) {
+      best = score;
+      id = i;
+    }
+  }
+  const std::string& name = signatures[id].text();
+  const size_t count = std::count_if(
+      signatures.begin(), signatures.end(),
+      [&name](const TokenSignature& s) { return s.text() == name; });
+  return std::make_pair(id, count);
+}
+
+} // namespace Explorer
+
+} // namespace TitleFinder
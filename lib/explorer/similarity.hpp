@@ -0,0 +1,96 @@
+/**
+ * @file explorer/similarity.hpp
+ *
+ * @brief Word based title similarity
+ *
+ * @author Jordan Bieder
+ *
+ * @copyright Copyright (C) 2023 Jordan Bieder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace TitleFinder {
+
+namespace Explorer {
+
+/**
+ * Jaro-Winkler similarity between 0 (nothing in common) and 1 (identical).
+ */
+double jaroWinkler(std::string_view a, std::string_view b);
+
+/**
+ * Normalized title split in words, ordered by word hash with duplicates
+ * removed so that two signatures intersect with a single merge.
+ */
+class TokenSignature {
+
+public:
+  explicit TokenSignature(const std::string& title);
+
+  inline const std::string& text() const { return _text; }
+
+  inline size_t size() const { return _tokens.size(); }
+
+  /**
+   * Token set similarity: the common words compared to each side.
+   * Word order and words present on one side only cost little.
+   */
+  double similarity(const TokenSignature& other) const;
+
+private:
+  struct Token {
+    uint64_t hash;
+    uint32_t offset; ///< position of the word in _text
+    uint32_t length;
+  };
+
+  inline std::string_view word(const Token& t) const {
+    return std::string_view(_text).substr(t.offset, t.length);
+  }
+
+  std::string _text;
+  std::vector<Token> _tokens;
+};
+
+/**
+ * Search result as seen by the scorer.
+ */
+struct Candidate {
+  std::string name{};
+  double popularity = -1; ///< TMDB popularity, negative if unknown
+  int year = -1;          ///< -1 if unknown
+};
+
+/**
+ * Rank all candidates against title with the token set similarity, then
+ * popularity and proximity to year (ignored if -1).
+ * @return the index of the best candidate and the number of candidates
+ * sharing its normalized name.
+ */
+std::pair<size_t, size_t> bestTokenMatch(const std::vector<Candidate>& list,
+                                         const std::string& title, int year);
+
+} // namespace Explorer
+
+} // namespace TitleFinder
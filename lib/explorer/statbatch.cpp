@@ -0,0 +1,297 @@
+/**
+ * @file explorer/statbatch.cpp
+ *
+ * @brief Batched file status queries
+ *
+ * @author Jordan Bieder
+ *
+ * @copyright Copyright (C) 2023 Jordan Bieder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "explorer/statbatch.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+#include <sys/stat.h>
+
+#include "explorer/logger.hpp"
+
+#ifdef HAVE_IO_URING
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+using TitleFinder::Explorer::FileStatus;
+
+FileStatus statFile(const std::filesystem::path& p) {
+  FileStatus status;
+  struct stat st;
+  if (::stat(p.c_str(), &st) != 0)
+    return status;
+  status.valid = true;
+  status.regular = S_ISREG(st.st_mode);
+  status.device = static_cast<uint64_t>(st.st_dev);
+  status.inode = static_cast<uint64_t>(st.st_ino);
+  status.size = static_cast<uint64_t>(st.st_size);
+  status.mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 +
+                 st.st_mtim.tv_nsec;
+  return status;
+}
+
+#ifdef HAVE_IO_URING
+FileStatus fromStatx(const struct statx& stx) {
+  FileStatus status;
+  status.valid = true;
+  status.regular = S_ISREG(stx.stx_mode);
+  // Same value as st_dev, the manifest compares both
+  status.device =
+      static_cast<uint64_t>(makedev(stx.stx_dev_major, stx.stx_dev_minor));
+  status.inode = stx.stx_ino;
+  status.size = stx.stx_size;
+  status.mtime = static_cast<int64_t>(stx.stx_mtime.tv_sec) * 1000000000 +
+                 stx.stx_mtime.tv_nsec;
+  return status;
+}
+#endif
+
+} // namespace
+
+namespace TitleFinder {
+
+namespace Explorer {
+
+#ifdef HAVE_IO_URING
+/**
+ * Submission and completion queues shared with the kernel
+ * (see io_uring_setup(2)), without liburing.
+ */
+struct StatBatch::Ring {
+  int fd = -1;
+  unsigned entries = 0;
+  void* sq = MAP_FAILED;
+  size_t sqSize = 0;
+  void* cq = MAP_FAILED;
+  size_t cqSize = 0;
+  io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+  size_t sqesSize = 0;
+  unsigned* sqTail = nullptr;
+  unsigned* sqMask = nullptr;
+  unsigned* sqArray = nullptr;
+  unsigned* cqHead = nullptr;
+  unsigned* cqTail = nullptr;
+  unsigned* cqMask = nullptr;
+  io_uring_cqe* cqes = nullptr;
+
+  explicit Ring(unsigned depth) {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    fd = static_cast<int>(::syscall(__NR_io_uring_setup, depth, &params));
+    if (fd < 0)
+      throw std::system_error(errno, std::generic_category(),
+                              "io_uring_setup");
+    entries = params.sq_entries;
+    sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single)
+      sqSize = cqSize = std::max(sqSize, cqSize);
+    sq = ::mmap(nullptr, sqSize, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED)
+      this->fail("mmap");
+    if (single) {
+      cq = sq;
+    } else {
+      cq = ::mmap(nullptr, cqSize, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+      if (cq == MAP_FAILED)
+        this->fail("mmap");
+    }
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = static_cast<io_uring_sqe*>(
+        ::mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+    if (sqes == MAP_FAILED)
+      this->fail("mmap");
+
+    auto* sqBase = static_cast<char*>(sq);
+    sqTail = reinterpret_cast<unsigned*>(sqBase + params.sq_off.tail);
+    sqMask = reinterpret_cast<unsigned*>(sqBase + params.sq_off.ring_mask);
+    sqArray = reinterpret_cast<unsigned*>(sqBase + params.sq_off.array);
+    auto* cqBase = static_cast<char*>(cq);
+    cqHead = reinterpret_cast<unsigned*>(cqBase + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned*>(cqBase + params.cq_off.tail);
+    cqMask = reinterpret_cast<unsigned*>(cqBase + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cqBase + params.cq_off.cqes);
+  }
+
+  Ring(const Ring&) = delete;
+  Ring& operator=(const Ring&) = delete;
+
+  ~Ring() { this->release(); }
+
+  [[noreturn]] void fail(const char* what) {
+    const int error = errno;
+    this->release();
+    throw std::system_error(error, std::generic_category(), what);
+  }
+
+  void release() {
+    if (sqes != MAP_FAILED)
+      ::munmap(sqes, sqesSize);
+    if (cq != MAP_FAILED && cq != sq)
+      ::munmap(cq, cqSize);
+    if (sq != MAP_FAILED)
+      ::munmap(sq, sqSize);
+    if (fd >= 0)
+      ::close(fd);
+    sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    cq = sq = MAP_FAILED;
+    fd = -1;
+  }
+
+  int enter(unsigned submit, unsigned wait) {
+    int ret;
+    do {
+      ret = static_cast<int>(::syscall(__NR_io_uring_enter, fd, submit, wait,
+                                       IORING_ENTER_GETEVENTS, nullptr, 0));
+    } while (ret < 0 && errno == EINTR);
+    return ret;
+  }
+};
+#else
+struct StatBatch::Ring {};
+#endif
+
+StatBatch::StatBatch(bool asynchronous, unsigned depth) : _ring(nullptr) {
+#ifdef HAVE_IO_URING
+  if (!asynchronous)
+    return;
+  try {
+    _ring = std::make_unique<Ring>(std::max(depth, 1u));
+    Logger()->debug("Stat calls go through io_uring ({} entries)",
+                    _ring->entries);
+  } catch (const std::exception& e) {
+    Logger()->debug("io_uring unavailable ({}), stat files one by one",
+                    e.what());
+  }
+#else
+  if (asynchronous)
+    Logger()->debug("Built without io_uring, stat files one by one");
+  (void)depth;
+#endif
+}
+
+StatBatch::~StatBatch() = default;
+
+bool StatBatch::isAsynchronous() const { return _ring != nullptr; }
+
+std::vector<FileStatus>
+StatBatch::stat(const std::vector<std::filesystem::path>& files) {
+  std::vector<FileStatus> out(files.size());
+  std::vector<bool> done(files.size(), false);
+#ifdef HAVE_IO_URING
+  for (size_t begin = 0; _ring && begin < files.size();
+       begin += _ring->entries) {
+    const size_t end = std::min<size_t>(files.size(), begin + _ring->entries);
+    if (!this->submit(files, begin, end, out, done)) {
+      Logger()->warn("io_uring failed, stat files one by one");
+      _ring.reset();
+    }
+  }
+#endif
+  for (size_t i = 0; i < files.size(); ++i) {
+    if (!done[i])
+      out[i] = statFile(files[i]);
+  }
+  return out;
+}
+
+bool StatBatch::submit(const std::vector<std::filesystem::path>& files,
+                       size_t begin, size_t end, std::vector<FileStatus>& out,
+                       std::vector<bool>& done) {
+#ifdef HAVE_IO_URING
+  Ring& ring = *_ring;
+  std::vector<struct statx> buffers(end - begin);
+  unsigned tail = *ring.sqTail;
+  for (size_t i = begin; i < end; ++i) {
+    const unsigned index = tail & *ring.sqMask;
+    io_uring_sqe& sqe = ring.sqes[index];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_STATX;
+    sqe.fd = AT_FDCWD;
+    sqe.addr = reinterpret_cast<uint64_t>(files[i].c_str());
+    sqe.len = STATX_BASIC_STATS;
+    sqe.off = reinterpret_cast<uint64_t>(&buffers[i - begin]);
+    sqe.user_data = i;
+    ring.sqArray[index] = index;
+    ++tail;
+  }
+  // The kernel must see the entries before the new tail
+  __atomic_store_n(ring.sqTail, tail, __ATOMIC_RELEASE);
+
+  const unsigned count = static_cast<unsigned>(end - begin);
+  unsigned submitted = 0;
+  unsigned completed = 0;
+  bool unsupported = false;
+  while (completed < count) {
+    const int ret = ring.enter(count - submitted, 1);
+    if (ret < 0) {
+      // Calls in flight still write to buffers: drain them first
+      if (errno != EBUSY && errno != EAGAIN && submitted == completed)
+        return false;
+    } else {
+      submitted += static_cast<unsigned>(ret);
+    }
+    unsigned head = *ring.cqHead;
+    const unsigned last = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+    for (; head != last; ++head, ++completed) {
+      const io_uring_cqe& cqe = ring.cqes[head & *ring.cqMask];
+      const size_t i = static_cast<size_t>(cqe.user_data);
+      if (cqe.res == 0) {
+        out[i] = fromStatx(buffers[i - begin]);
+        done[i] = true;
+      } else if (cqe.res == -EINVAL || cqe.res == -EOPNOTSUPP) {
+        // Kernels before 5.6 know io_uring but not statx
+        unsupported = true;
+      } else {
+        done[i] = true;
+      }
+    }
+    __atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+  }
+  return !unsupported;
+#else
+  (void)files;
+  (void)begin;
+  (void)end;
+  (void)out;
+  (void)done;
+  return false;
+#endif
+}
+
+} // namespace Explorer
+
+} // namespace TitleFinder
@@ -0,0 +1,100 @@
+/**
+ * @file explorer/statbatch.hpp
+ *
+ * @brief Batched file status queries
+ *
+ * @author Jordan Bieder
+ *
+ * @copyright Copyright (C) 2023 Jordan Bieder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+namespace TitleFinder {
+
+namespace Explorer {
+
+/**
+ * What stat tells about a file, symbolic links followed.
+ */
+struct FileStatus {
+  bool valid = false; ///< false if the file cannot be stat'ed
+  bool regular = false;
+  uint64_t device = 0;
+  uint64_t inode = 0;
+  uint64_t size = 0;
+  int64_t mtime = 0; ///< nanoseconds
+};
+
+/**
+ * Stat many files at once.
+ * If asynchronous, on Linux when built with io_uring support and allowed
+ * by the kernel, the statx calls of a batch are all submitted together and
+ * run concurrently, which hides the latency of network storage. It costs
+ * more than it saves on local disks, where metadata is usually cached.
+ * Otherwise files are stat'ed one after the other.
+ * An instance must not be used from several threads at the same time.
+ */
+class StatBatch {
+
+public:
+  /**
+   * depth is the number of calls in flight at most.
+   */
+  explicit StatBatch(bool asynchronous = false, unsigned depth = 64);
+
+  StatBatch(const StatBatch&) = delete;
+  StatBatch& operator=(const StatBatch&) = delete;
+
+  /**
+   * Destructor
+   */
+  virtual ~StatBatch();
+
+  /**
+   * @return one status per file, in the same order.
+   */
+  std::vector<FileStatus>
+  stat(const std::vector<std::filesystem::path>& files);
+
+  /**
+   * @return true if calls go through io_uring.
+   */
+  bool isAsynchronous() const;
+
+private:
+  struct Ring;
+
+  /**
+   * Stat files[begin, end) through the ring.
+   * @return false if the ring failed, nothing is lost: the caller falls
+   * back to stat for the files not done.
+   */
+  bool submit(const std::vector<std::filesystem::path>& files, size_t begin,
+              size_t end, std::vector<FileStatus>& out,
+              std::vector<bool>& done);
+
+  std::unique_ptr<Ring> _ring;
+};
+
+} // namespace Explorer
+
+} // namespace TitleFinder
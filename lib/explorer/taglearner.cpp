@@ -0,0 +1,140 @@
+/**
+ * @file explorer/taglearner.cpp
+ *
+ * @brief Release tags learned from the file names of a scan
+ *
+ * @author Jordan Bieder
+ *
+ * @copyright Copyright (C) 2023 Jordan Bieder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "explorer/taglearner.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <utility>
+
+#include "explorer/discriminator.hpp"
+#include "explorer/hash.hpp"
+#include "explorer/normalize.hpp"
+
+namespace {
+
+std::vector<std::string_view> words(std::string_view s) {
+  std::vector<std::string_view> out;
+  size_t pos = 0;
+  while (pos < s.size()) {
+    const size_t end = std::min(s.find(' ', pos), s.size());
+    if (end > pos)
+      out.push_back(s.substr(pos, end - pos));
+    pos = end + 1;
+  }
+  return out;
+}
+
+/**
+ * Numbers (years, episode numbers) and SxxEyy/NNxNN markers are what the
+ * Discriminator relies on, they must never be stripped.
+ */
+bool isMarker(std::string_view w) {
+  if (std::all_of(w.begin(), w.end(),
+                  [](unsigned char c) { return std::isdigit(c); }))
+    return true;
+  size_t i = 0;
+  if (w[0] == 's')
+    ++i;
+  const size_t season = i;
+  while (i < w.size() && std::isdigit(static_cast<unsigned char>(w[i])))
+    ++i;
+  if (i == season || i == w.size() || (w[i] != 'e' && w[i] != 'x'))
+    return false;
+  const size_t episode = ++i;
+  while (i < w.size() && std::isdigit(static_cast<unsigned char>(w[i])))
+    ++i;
+  return i > episode && i == w.size();
+}
+
+} // namespace
+
+namespace TitleFinder {
+
+namespace Explorer {
+
+TagLearner::TagLearner(size_t minTitles)
+    : _minTitles(std::max<size_t>(minTitles, 1)), _words() {}
+
+void TagLearner::add(std::string_view path) {
+  Discriminator discri;
+  discri.getType(path);
+  const std::string title = normalizeTitle(discri.getTitle());
+  const auto inside = words(title);
+  if (inside.empty())
+    return;
+  const uint64_t id = fnv1a(title);
+
+  std::string_view name = path.substr(path.find_last_of('/') + 1);
+  const size_t dot = name.rfind('.');
+  if (dot != std::string_view::npos && dot != 0)
+    name = name.substr(0, dot);
+  // The title is a prefix of the name and normalization works character by
+  // character, so the words of the title are the first words of the name.
+  const std::string normalized = normalizeTitle(name);
+  const auto all = words(normalized);
+
+  for (const auto& w : inside)
+    _words[std::string(w)].inside.insert(id);
+  for (size_t i = inside.size(); i < all.size(); ++i) {
+    if (!isMarker(all[i]))
+      _words[std::string(all[i])].after.insert(id);
+  }
+}
+
+std::vector<std::string> TagLearner::tags() const {
+  std::vector<std::pair<size_t, const std::string*>> found;
+  for (const auto& [word, counts] : _words) {
+    const size_t after = counts.after.size();
+    if (after >= _minTitles && after > counts.inside.size())
+      found.emplace_back(after, &word);
+  }
+  std::sort(found.begin(), found.end(), [](const auto& a, const auto& b) {
+    return a.first != b.first ? a.first > b.first : *a.second < *b.second;
+  });
+  std::vector<std::string> out;
+  out.reserve(found.size());
+  for (const auto& f : found)
+    out.push_back(*f.second);
+  return out;
+}
+
+std::string stripTags(const std::string& title,
+                      const std::unordered_set<std::string>& tags) {
+  if (tags.empty())
+    return title;
+  std::string out;
+  out.reserve(title.size());
+  for (const auto& w : words(title)) {
+    if (tags.count(std::string(w)))
+      continue;
+    if (!out.empty())
+      out.push_back(' ');
+    out.append(w);
+  }
+  return out.empty() ? title : out;
+}
+
+} // namespace Explorer
+
+} // namespace TitleFinder
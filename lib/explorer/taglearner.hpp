@@ -0,0 +1,90 @@
+/**
+ * @file explorer/taglearner.hpp
+ *
+ * @brief Release tags learned from the file names of a scan
+ *
+ * @author Jordan Bieder
+ *
+ * @copyright Copyright (C) 2023 Jordan Bieder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace TitleFinder {
+
+namespace Explorer {
+
+/**
+ * Collects word statistics over the file names of a scan to find release
+ * tags (groups, codecs, resolutions...) nobody put in the blacklist.
+ *
+ * Words following the year or episode number of a name are junk in most
+ * names, so a word seen there for several different titles is a tag, unless
+ * it appears even more often inside titles ("the", "of"...). Titles are
+ * counted rather than files so that a whole season of a show weighs as
+ * much as a single movie.
+ */
+class TagLearner {
+
+public:
+  /**
+   * A word becomes a tag once it follows at least minTitles titles.
+   */
+  explicit TagLearner(size_t minTitles = 3);
+
+  /**
+   * Destructor
+   */
+  virtual ~TagLearner() = default;
+
+  /**
+   * Account for the file name of path (directories are ignored).
+   */
+  void add(std::string_view path);
+
+  /**
+   * @return the learned tags, normalized, most frequent first.
+   */
+  std::vector<std::string> tags() const;
+
+private:
+  struct Counts {
+    std::unordered_set<uint64_t> after{};  ///< titles followed by the word
+    std::unordered_set<uint64_t> inside{}; ///< titles containing the word
+  };
+
+  size_t _minTitles;
+  std::unordered_map<std::string, Counts> _words;
+};
+
+/**
+ * Remove the words of title (normalized) that are in tags.
+ * The title is returned untouched if nothing would be left.
+ */
+std::string stripTags(const std::string& title,
+                      const std::unordered_set<std::string>& tags);
+
+} // namespace Explorer
+
+} // namespace TitleFinder
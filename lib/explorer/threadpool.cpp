@@ -0,0 +1,172 @@
+/**
+ * @file explorer/threadpool.cpp
+ *
+ * @brief Work stealing thread pool
+ *
+ * @author Jordan Bieder
+ *
+ * @copyright Copyright (C) 2023 Jordan Bieder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "explorer/threadpool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+
+#include "explorer/logger.hpp"
+
+namespace {
+
+/**
+ * Queue of the worker running on this thread, if any.
+ */
+struct Identity {
+  const void* pool = nullptr;
+  size_t queue = 0;
+};
+
+thread_local Identity current;
+
+} // namespace
+
+namespace TitleFinder {
+
+namespace Explorer {
+
+ThreadPool::ThreadPool(size_t threads)
+    : _queues(), _threads(), _queued(0), _pending(0), _sleeping(0), _next(0),
+      _mutex(), _wake(), _stop(false) {
+  const size_t workers = threads > 1 ? threads - 1 : 0;
+  for (size_t i = 0; i <= workers; ++i)
+    _queues.push_back(std::make_unique<Queue>());
+  for (size_t i = 0; i < workers; ++i)
+    _threads.emplace_back(&ThreadPool::work, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+  this->wait();
+  {
+    std::lock_guard lock(_mutex);
+    _stop = true;
+  }
+  _wake.notify_all();
+  for (auto& t : _threads)
+    t.join();
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+  const size_t index = current.pool == this
+                           ? current.queue
+                           : _next.fetch_add(1) % _queues.size();
+  _pending.fetch_add(1);
+  {
+    std::lock_guard lock(_queues[index]->mutex);
+    _queues[index]->tasks.push_back(std::move(task));
+  }
+  _queued.fetch_add(1);
+  // A worker going to sleep increments _sleeping before checking _queued,
+  // so one of both sides sees the other.
+  if (_sleeping.load() > 0) {
+    { std::lock_guard lock(_mutex); }
+    _wake.notify_one();
+  }
+}
+
+bool ThreadPool::take(size_t self, std::function<void()>& task) {
+  if (_queued.load() == 0)
+    return false;
+  {
+    auto& own = *_queues[self];
+    std::lock_guard lock(own.mutex);
+    if (!own.tasks.empty()) {
+      task = std::move(own.tasks.back());
+      own.tasks.pop_back();
+      _queued.fetch_sub(1);
+      return true;
+    }
+  }
+  for (size_t i = 1; i < _queues.size(); ++i) {
+    auto& victim = *_queues[(self + i) % _queues.size()];
+    std::unique_lock lock(victim.mutex, std::try_to_lock);
+    if (!lock.owns_lock() || victim.tasks.empty())
+      continue;
+    task = std::move(victim.tasks.front());
+    victim.tasks.pop_front();
+    _queued.fetch_sub(1);
+    return true;
+  }
+  return false;
+}
+
+void ThreadPool::execute(std::function<void()>& task) {
+  try {
+    task();
+  } catch (const std::exception& e) {
+    Logger()->error("Task failed with: {}", e.what());
+  } catch (...) {
+    Logger()->error("Task failed");
+  }
+  task = nullptr;
+  if (_pending.fetch_sub(1) == 1) {
+    { std::lock_guard lock(_mutex); }
+    _wake.notify_all();
+  }
+}
+
+void ThreadPool::work(size_t self) {
+  current = {this, self};
+  std::function<void()> task;
+  while (true) {
+    if (this->take(self, task)) {
+      this->execute(task);
+      continue;
+    }
+    std::unique_lock lock(_mutex);
+    _sleeping.fetch_add(1);
+    // Steals may fail on a busy deque, hence the timeout
+    _wake.wait_for(lock, std::chrono::milliseconds(10),
+                   [this] { return _stop || _queued.load() > 0; });
+    _sleeping.fetch_sub(1);
+    if (_stop && _queued.load() == 0)
+      return;
+  }
+}
+
+void ThreadPool::wait() {
+  const Identity previous = current;
+  const size_t self = _queues.size() - 1;
+  if (current.pool != this)
+    current = {this, self};
+  std::function<void()> task;
+  while (_pending.load() > 0) {
+    if (this->take(current.queue, task)) {
+      this->execute(task);
+      continue;
+    }
+    std::unique_lock lock(_mutex);
+    _sleeping.fetch_add(1);
+    _wake.wait_for(lock, std::chrono::milliseconds(10), [this] {
+      return _pending.load() == 0 || _queued.load() > 0;
+    });
+    _sleeping.fetch_sub(1);
+  }
+  current = previous;
+}
+
+} // namespace Explorer
+
+} // namespace TitleFinder
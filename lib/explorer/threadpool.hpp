@@ -0,0 +1,107 @@
+/**
+ * @file explorer/threadpool.hpp
+ *
+ * @brief Work stealing thread pool
+ *
+ * @author Jordan Bieder
+ *
+ * @copyright Copyright (C) 2023 Jordan Bieder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace TitleFinder {
+
+namespace Explorer {
+
+/**
+ * Each worker owns a deque: it runs the tasks it submits itself last in
+ * first out and, once empty, steals the oldest task of another deque. Tasks
+ * submitted from outside the pool are dealt round robin. There is no lock
+ * shared by all workers on the way of a task.
+ */
+class ThreadPool {
+
+public:
+  /**
+   * threads counts the thread calling wait(), which runs tasks as well:
+   * threads - 1 workers are started.
+   */
+  explicit ThreadPool(size_t threads);
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  /**
+   * Destructor
+   * Runs the remaining tasks then stops the workers.
+   */
+  virtual ~ThreadPool();
+
+  /**
+   * Queue task. Tasks may submit other tasks.
+   * Exceptions escaping a task are logged and dropped.
+   */
+  void submit(std::function<void()> task);
+
+  /**
+   * Help running tasks until every submitted task is done.
+   * Not to be called from a task.
+   */
+  void wait();
+
+  inline size_t size() const { return _threads.size() + 1; }
+
+private:
+  struct Queue {
+    std::mutex mutex{};
+    std::deque<std::function<void()>> tasks{};
+  };
+
+  /**
+   * Take a task: from the back of queue self, else from the front of
+   * another queue.
+   */
+  bool take(size_t self, std::function<void()>& task);
+
+  void execute(std::function<void()>& task);
+
+  void work(size_t self);
+
+  std::vector<std::unique_ptr<Queue>> _queues; ///< last one is external
+  std::vector<std::thread> _threads;
+  std::atomic<size_t> _queued;  ///< tasks waiting in a queue
+  std::atomic<size_t> _pending; ///< tasks submitted and not finished
+  std::atomic<size_t> _sleeping;
+  std::atomic<size_t> _next;
+  std::mutex _mutex;
+  std::condition_variable _wake;
+  bool _stop;
+};
+
+} // namespace Explorer
+
+} // namespace TitleFinder
@@ -0,0 +1,154 @@
+/**
+ * @file explorer/treewalker.cpp
+ *
+ * @brief Parallel directory traversal
+ *
+ * @author Jordan Bieder
+ *
+ * @copyright Copyright (C) 2023 Jordan Bieder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "explorer/treewalker.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <sys/stat.h>
+#include <system_error>
+
+#include "explorer/logger.hpp"
+#include "explorer/threadpool.hpp"
+
+namespace TitleFinder {
+
+namespace Explorer {
+
+TreeWalker::TreeWalker(size_t threads)
+    : _threads(std::max<size_t>(threads, 1)), _prune(nullptr),
+      _select(nullptr), _asynchronous(false), _batches(), _batchesMutex(),
+      _visited(), _visitedMutex(), _consumerMutex() {}
+
+void TreeWalker::setPrune(Prune prune) { _prune = std::move(prune); }
+
+void TreeWalker::setSelect(Select select) { _select = std::move(select); }
+
+void TreeWalker::useAsynchronousStat(bool asynchronous) {
+  std::lock_guard lock(_batchesMutex);
+  _asynchronous = asynchronous;
+  _batches.clear();
+}
+
+std::unique_ptr<StatBatch> TreeWalker::borrow() {
+  std::lock_guard lock(_batchesMutex);
+  if (_batches.empty())
+    return std::make_unique<StatBatch>(_asynchronous);
+  auto batch = std::move(_batches.back());
+  _batches.pop_back();
+  return batch;
+}
+
+void TreeWalker::giveBack(std::unique_ptr<StatBatch> batch) {
+  std::lock_guard lock(_batchesMutex);
+  _batches.push_back(std::move(batch));
+}
+
+bool TreeWalker::enter(const std::filesystem::path& directory) {
+  struct stat st;
+  if (::stat(directory.c_str(), &st) != 0)
+    return false;
+  std::lock_guard lock(_visitedMutex);
+  return _visited
+      .emplace(static_cast<uint64_t>(st.st_dev),
+               static_cast<uint64_t>(st.st_ino))
+      .second;
+}
+
+size_t TreeWalker::walk(const std::filesystem::path& root, bool recursive,
+                        size_t batchSize, const Accept& accept,
+                        const Consumer& consumer) {
+  {
+    std::lock_guard lock(_visitedMutex);
+    _visited.clear();
+  }
+  if (!this->enter(root))
+    return 0;
+
+  std::atomic<size_t> listed{0};
+  ThreadPool pool(_threads);
+  std::function<void(std::filesystem::path)> list;
+  list = [&](std::filesystem::path directory) {
+    std::vector<std::filesystem::path> files;
+    std::error_code error;
+    std::filesystem::directory_iterator it{
+        directory, std::filesystem::directory_options::skip_permission_denied,
+        error};
+    for (; !error && it != std::filesystem::directory_iterator();
+         it.increment(error)) {
+      const auto& entry = *it;
+      std::error_code type;
+      if (recursive && entry.is_directory(type)) {
+        if (_prune && _prune(entry.path())) {
+          Logger()->debug("Pruning {}", entry.path().string());
+          continue;
+        }
+        if (!this->enter(entry.path())) {
+          Logger()->debug("Skipping {}, already visited",
+                          entry.path().string());
+          continue;
+        }
+        pool.submit([&list, sub = entry.path()] { list(sub); });
+      } else if (!_select || _select(entry.path())) {
+        files.push_back(entry.path());
+      }
+    }
+    if (error)
+      Logger()->error("Listing {} failed: {}", directory.string(),
+                      error.message());
+    ++listed;
+
+    // One round of stat calls for the whole folder
+    auto batch = this->borrow();
+    const auto status = batch->stat(files);
+    this->giveBack(std::move(batch));
+    std::vector<size_t> kept;
+    for (size_t i = 0; i < files.size(); ++i) {
+      if (accept(files[i], status[i]))
+        kept.push_back(i);
+    }
+    std::sort(kept.begin(), kept.end(),
+              [&files](size_t l, size_t r) { return files[l] < files[r]; });
+
+    std::lock_guard lock(_consumerMutex);
+    for (size_t begin = 0; begin < kept.size(); begin += batchSize) {
+      const size_t end = std::min(kept.size(), begin + batchSize);
+      std::vector<std::filesystem::path> paths;
+      std::vector<FileStatus> statuses;
+      paths.reserve(end - begin);
+      statuses.reserve(end - begin);
+      for (size_t i = begin; i < end; ++i) {
+        paths.push_back(std::move(files[kept[i]]));
+        statuses.push_back(status[kept[i]]);
+      }
+      consumer(paths, statuses);
+    }
+  };
+  pool.submit([&list, &root] { list(root); });
+  pool.wait();
+  return listed.load();
+}
+
+} // namespace Explorer
+
+} // namespace TitleFinder
@@ -0,0 +1,129 @@
+/**
+ * @file explorer/treewalker.hpp
+ *
+ * @brief Parallel directory traversal
+ *
+ * @author Jordan Bieder
+ *
+ * @copyright Copyright (C) 2023 Jordan Bieder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "explorer/statbatch.hpp"
+
+namespace TitleFinder {
+
+namespace Explorer {
+
+/**
+ * Lists a tree with one task per directory on a thread pool, so that the
+ * round trips of a network file system overlap.
+ * Directories are identified by (device, inode): symbolic links and bind
+ * mounts are followed without looping.
+ */
+class TreeWalker {
+
+public:
+  /**
+   * @return true for a directory (not the root) to skip with its subtree.
+   */
+  using Prune = std::function<bool(const std::filesystem::path&)>;
+
+  /**
+   * @return true for a file worth a stat, from its path only.
+   * Called concurrently.
+   */
+  using Select = std::function<bool(const std::filesystem::path&)>;
+
+  /**
+   * @return true for a file to hand to the consumer.
+   * Called concurrently.
+   */
+  using Accept =
+      std::function<bool(const std::filesystem::path&, const FileStatus&)>;
+
+  /**
+   * Receives the accepted files of one directory, sorted, by batches, with
+   * the status accept saw for each.
+   * Never called concurrently; the walk waits while it runs.
+   */
+  using Consumer = std::function<void(std::vector<std::filesystem::path>&,
+                                      std::vector<FileStatus>&)>;
+
+  explicit TreeWalker(size_t threads);
+
+  /**
+   * Destructor
+   */
+  virtual ~TreeWalker() = default;
+
+  void setPrune(Prune prune);
+
+  void setSelect(Select select);
+
+  /**
+   * Stat the selected files of a folder through io_uring (see StatBatch).
+   */
+  void useAsynchronousStat(bool asynchronous);
+
+  /**
+   * Walk root (and its subdirectories if recursive).
+   * @return the number of directories listed.
+   */
+  size_t walk(const std::filesystem::path& root, bool recursive,
+              size_t batchSize, const Accept& accept,
+              const Consumer& consumer);
+
+private:
+  using Key = std::pair<uint64_t, uint64_t>;
+
+  /**
+   * @return false if directory was already visited or cannot be stat'ed.
+   */
+  bool enter(const std::filesystem::path& directory);
+
+  /**
+   * Take a StatBatch nobody uses, the walker owns at most one per thread.
+   */
+  std::unique_ptr<StatBatch> borrow();
+
+  void giveBack(std::unique_ptr<StatBatch> batch);
+
+  size_t _threads;
+  Prune _prune;
+  Select _select;
+  bool _asynchronous;
+  std::vector<std::unique_ptr<StatBatch>> _batches;
+  std::mutex _batchesMutex;
+  std::set<Key> _visited;
+  std::mutex _visitedMutex;
+  std::mutex _consumerMutex;
+};
+
+} // namespace Explorer
+
+} // namespace TitleFinder
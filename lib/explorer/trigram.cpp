@@ -0,0 +1,168 @@
+/**
+ * @file explorer/trigram.cpp
+ *
+ * @brief Trigram posting lists for approximate lookups
+ *
+ * @author Jordan Bieder
+ *
+ * @copyright Copyright (C) 2023 Jordan Bieder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "explorer/trigram.hpp"
+
+#include <algorithm>
+
+namespace TitleFinder {
+
+namespace Explorer {
+
+std::vector<uint32_t> trigrams(std::string_view key) {
+  std::vector<uint32_t> result;
+  if (key.empty())
+    return result;
+  result.reserve(key.size());
+  auto at = [&key](size_t i) -> uint32_t {
+    return i == 0 || i > key.size() ? ' '
+                                    : static_cast<unsigned char>(key[i - 1]);
+  };
+  for (size_t i = 0; i < key.size(); ++i)
+    result.push_back(at(i) << 16 | at(i + 1) << 8 | at(i + 2));
+  std::sort(result.begin(), result.end());
+  result.erase(std::unique(result.begin(), result.end()), result.end());
+  return result;
+}
+
+TrigramIndex::TrigramIndex()
+    : _pending(), _lengths(), _trigrams(), _offsets(), _postings(), _ids(),
+      _byLength() {}
+
+void TrigramIndex::add(uint32_t id, std::string_view key) {
+  const auto rank = static_cast<uint32_t>(_ids.size());
+  for (uint32_t t : trigrams(key))
+    _pending.push_back(static_cast<uint64_t>(t) << 32 | rank);
+  _ids.push_back(id);
+  _lengths.push_back(static_cast<uint32_t>(key.size()));
+}
+
+void TrigramIndex::build() {
+  // Renumber keys by length, keeping the insertion order among equals
+  std::vector<uint32_t> order(_ids.size());
+  for (uint32_t i = 0; i < order.size(); ++i)
+    order[i] = i;
+  std::stable_sort(order.begin(), order.end(),
+                   [this](uint32_t l, uint32_t r) {
+                     return _lengths[l] < _lengths[r];
+                   });
+  std::vector<uint32_t> rank(order.size());
+  std::vector<uint32_t> ids(order.size());
+  _byLength.clear();
+  for (uint32_t i = 0; i < order.size(); ++i) {
+    rank[order[i]] = i;
+    ids[i] = _ids[order[i]];
+    while (_byLength.size() <= _lengths[order[i]])
+      _byLength.push_back(i);
+  }
+  _byLength.push_back(static_cast<uint32_t>(order.size()));
+  _ids = std::move(ids);
+
+  for (auto& p : _pending)
+    p = (p & 0xFFFFFFFF00000000ULL) | rank[static_cast<uint32_t>(p)];
+  std::sort(_pending.begin(), _pending.end());
+  _trigrams.clear();
+  _offsets.clear();
+  _postings.resize(_pending.size());
+  for (size_t i = 0; i < _pending.size(); ++i) {
+    const auto t = static_cast<uint32_t>(_pending[i] >> 32);
+    if (_trigrams.empty() || _trigrams.back() != t) {
+      _trigrams.push_back(t);
+      _offsets.push_back(static_cast<uint32_t>(i));
+    }
+    _postings[i] = static_cast<uint32_t>(_pending[i]);
+  }
+  _offsets.push_back(static_cast<uint32_t>(_postings.size()));
+  _pending.clear();
+  _pending.shrink_to_fit();
+  _lengths.clear();
+  _lengths.shrink_to_fit();
+}
+
+uint32_t TrigramIndex::firstOfLength(size_t length) const {
+  return length < _byLength.size() ? _byLength[length] : _byLength.back();
+}
+
+TrigramIndex::List TrigramIndex::postings(uint32_t trigram) const {
+  auto it = std::lower_bound(_trigrams.begin(), _trigrams.end(), trigram);
+  if (it == _trigrams.end() || *it != trigram)
+    return List(nullptr, nullptr);
+  const size_t i = static_cast<size_t>(it - _trigrams.begin());
+  return List(_postings.data() + _offsets[i],
+              _postings.data() + _offsets[i + 1]);
+}
+
+std::vector<uint32_t> TrigramIndex::candidates(std::string_view key,
+                                               unsigned maxDistance) const {
+  std::vector<uint32_t> result;
+  const auto grams = trigrams(key);
+  if (grams.empty())
+    return result;
+  const size_t edits = std::min<size_t>(maxDistance, (grams.size() - 1) / 3);
+  const size_t needed = grams.size() - 3 * edits;
+
+  // Keys whose length differs by more than edits are out of reach
+  const uint32_t first =
+      this->firstOfLength(key.size() > edits ? key.size() - edits : 0);
+  const uint32_t last = this->firstOfLength(key.size() + edits + 1);
+  std::vector<List> lists;
+  lists.reserve(grams.size());
+  for (uint32_t t : grams) {
+    List l = this->postings(t);
+    l.first = std::lower_bound(l.first, l.second, first);
+    l.second = std::lower_bound(l.first, l.second, last);
+    lists.push_back(l);
+  }
+  std::sort(lists.begin(), lists.end(), [](const List& l, const List& r) {
+    return l.second - l.first < r.second - r.first;
+  });
+
+  // A key missing from all the rarest lists but (needed - 1) cannot reach
+  // needed shared trigrams: only those lists produce candidates.
+  const size_t probe = grams.size() - needed + 1;
+  std::vector<uint32_t> seen;
+  for (size_t l = 0; l < probe; ++l)
+    seen.insert(seen.end(), lists[l].first, lists[l].second);
+  std::sort(seen.begin(), seen.end());
+
+  for (size_t i = 0; i < seen.size();) {
+    const uint32_t id = seen[i];
+    size_t shared = 0;
+    for (; i < seen.size() && seen[i] == id; ++i)
+      ++shared;
+    // Check the remaining lists, stopping as soon as the answer is known
+    for (size_t l = probe; l < lists.size() && shared < needed &&
+                           shared + (lists.size() - l) >= needed;
+         ++l) {
+      if (std::binary_search(lists[l].first, lists[l].second, id))
+        ++shared;
+    }
+    if (shared >= needed)
+      result.push_back(_ids[id]);
+  }
+  return result;
+}
+
+} // namespace Explorer
+
+} // namespace TitleFinder
@@ -0,0 +1,96 @@
+/**
+ * @file explorer/trigram.hpp
+ *
+ * @brief Trigram posting lists for approximate lookups
+ *
+ * @author Jordan Bieder
+ *
+ * @copyright Copyright (C) 2023 Jordan Bieder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace TitleFinder {
+
+namespace Explorer {
+
+/**
+ * Inverted index from the trigrams of a key to the ids of the keys that
+ * contain them. Keys are padded with one space on each side so that a key
+ * of n bytes has n trigrams.
+ * Keys are numbered by length internally so that each posting list can be
+ * cut down to the keys of a compatible length with two binary searches.
+ */
+class TrigramIndex {
+
+public:
+  /**
+   * Empty constructor
+   */
+  TrigramIndex();
+
+  /**
+   * Index key under id. Call build() once every key is added.
+   */
+  void add(uint32_t id, std::string_view key);
+
+  /**
+   * Sort and compact the posting lists.
+   */
+  void build();
+
+  /**
+   * Ids of the keys that may be within maxDistance edits of key.
+   * One edit changes at most 3 trigrams, so every key closer than
+   * maxDistance shares at least |trigrams(key)| - 3 * maxDistance of them.
+   * maxDistance is lowered if needed to keep that bound positive.
+   */
+  std::vector<uint32_t> candidates(std::string_view key,
+                                   unsigned maxDistance) const;
+
+  inline size_t size() const { return _trigrams.size(); }
+
+private:
+  using List = std::pair<const uint32_t*, const uint32_t*>;
+
+  List postings(uint32_t trigram) const;
+
+  /**
+   * First internal number of the keys of at least length bytes.
+   */
+  uint32_t firstOfLength(size_t length) const;
+
+  std::vector<uint64_t> _pending; ///< trigram << 32 | rank until build()
+  std::vector<uint32_t> _lengths; ///< of each key, in insertion order
+  std::vector<uint32_t> _trigrams;
+  std::vector<uint32_t> _offsets;  ///< one more than _trigrams
+  std::vector<uint32_t> _postings; ///< internal numbers
+  std::vector<uint32_t> _ids;      ///< by internal number
+  std::vector<uint32_t> _byLength; ///< first internal number of each length
+};
+
+/**
+ * Sorted distinct trigrams of key (padded), each packed in 24 bits.
+ */
+std::vector<uint32_t> trigrams(std::string_view key);
+
+} // namespace Explorer
+
+} // namespace TitleFinder